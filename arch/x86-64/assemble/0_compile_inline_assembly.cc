@@ -3,6 +3,7 @@
 #define GRANARY_INTERNAL
 #define GRANARY_ARCH_INTERNAL
 
+#include "granary/base/option.h"
 #include "granary/base/string.h"
 
 #include "granary/cfg/block.h"
@@ -11,12 +12,16 @@
 
 #include "granary/code/inline_assembly.h"
 
+#include "arch/util.h"
+
 #include "arch/x86-64/builder.h"
 #include "arch/x86-64/select.h"
 
 #include "granary/breakpoint.h"
 #include "granary/cache.h"
 
+GRANARY_DECLARE_bool(specialize_inline_assembly);
+
 namespace granary {
 namespace arch {
 
@@ -46,7 +51,10 @@ class InlineAssemblyParser {
         block(block_),
         instr(instr_),
         ch(ch_),
-        num_immediates(0) {}
+        num_immediates(0),
+        dest_var(kMaxNumInlineVars),
+        var_is_constant(),
+        constant_values() {}
 
   void ParseInstructions(void) {
     while (*ch) {
@@ -54,6 +62,7 @@ class InlineAssemblyParser {
       if (!*ch) break;
       memset(&data, 0, sizeof data);
       num_immediates = 0;
+      dest_var = kMaxNumInlineVars;
       op = &(data.ops[0]);
       ParseInstruction();
     }
@@ -115,6 +124,48 @@ class InlineAssemblyParser {
     auto var_num = ParseVar();
     InitLabelVar(var_num);
     instr->InsertBefore(scope->vars[var_num]->annotation_instr);
+
+    // Control can reach the label from elsewhere, so register variables may
+    // no longer hold the constants that they held before the label.
+    memset(&(var_is_constant[0]), 0, sizeof var_is_constant);
+  }
+
+  // Forget about any constant held in the register variable(s) of `reg`.
+  void ForgetConstant(VirtualRegister reg) {
+    for (auto i = 0U; i < kMaxNumInlineVars; ++i) {
+      if (scope->var_is_initialized[i] && scope->vars[i]->IsRegister() &&
+          reg == scope->vars[i]->reg) {
+        var_is_constant[i] = false;
+      }
+    }
+  }
+
+  // Track which register variables hold known constants after the most
+  // recently parsed instruction, e.g. after a `MOV r64 %1, i64 %0`.
+  void TrackConstants(void) {
+    if (data.IsFunctionCall()) {
+      memset(&(var_is_constant[0]), 0, sizeof var_is_constant);
+      return;
+    }
+    for (auto i = 0U; i < data.num_explicit_ops; ++i) {
+      const auto &instr_op(data.ops[i]);
+      if (instr_op.IsRegister() &&
+          (instr_op.IsWrite() || instr_op.IsConditionalWrite())) {
+        ForgetConstant(instr_op.reg);
+      }
+    }
+    if (kMaxNumInlineVars <= dest_var || XED_ICLASS_MOV != data.iclass ||
+        !data.ops[1].IsImmediate()) {
+      return;
+    }
+    auto value = data.ops[1].imm.as_uint;
+    if (32 == data.ops[0].width) {
+      value = static_cast<uint32_t>(value);  // Zero-extended.
+    } else if (64 != data.ops[0].width) {
+      return;
+    }
+    var_is_constant[dest_var] = true;
+    constant_values[dest_var] = value;
   }
 
   // Parse the next thing as an explicitly state architectural register.
@@ -154,11 +205,71 @@ class InlineAssemblyParser {
     }
   }
 
+  // Try to specialize a memory operand like `[%0]` or `[%0 + 8]` into an
+  // absolute memory operand. This applies when `%0` is an input immediate
+  // (e.g. the address of some tool data) or a register variable known to hold
+  // a constant. Later assembly stages turn absolute memory operands into
+  // `RIP`-relative or `disp32` memory operands where they are reachable.
+  bool TryParseAbsoluteMemoryOperand(bool has_segment) {
+    const auto var_ch = ch;
+    auto var_num = ParseVar();
+    ConsumeWhiteSpace();
+
+    uint64_t addr = 0;
+    if (scope->var_is_initialized[var_num] &&
+        scope->vars[var_num]->IsImmediate()) {
+      addr = scope->vars[var_num]->imm.as_uint;
+    } else if (FLAG_specialize_inline_assembly && var_is_constant[var_num]) {
+      addr = constant_values[var_num];
+    } else {
+      ch = var_ch;
+      return false;
+    }
+
+    int32_t disp = 0;
+    if (Peek('+')) {
+      Accept('+');
+      ConsumeWhiteSpace();
+      if (PeekNumber()) {  // Literal displacement.
+        ParseWord();
+        if ('0' == buff[0]) {
+          DeFormat(buff, "%x", &disp);
+        } else {
+          DeFormat(buff, "%d", &disp);
+        }
+      } else if (Peek('%')) {  // Maybe a displacement immediate.
+        auto &aop(ParseOperandVar());
+        if (!aop.IsImmediate()) {
+          ch = var_ch;
+          return false;
+        }
+        disp = static_cast<int32_t>(aop.imm.as_int);
+        GRANARY_ASSERT(disp == aop.imm.as_int);
+      } else {
+        ch = var_ch;
+        return false;
+      }
+      ConsumeWhiteSpace();
+    }
+    addr += static_cast<uint64_t>(static_cast<int64_t>(disp));
+
+    // Segment offsets must fit in a `disp32`.
+    if (!Peek(']') || (has_segment && 32 < arch::ImmediateWidthBits(addr))) {
+      ch = var_ch;
+      return false;
+    }
+    Accept(']');
+    op->type = XED_ENCODER_OPERAND_TYPE_PTR;
+    op->addr.as_uint = addr;
+    op->is_compound = false;
+    return true;
+  }
+
   // Parse a compound memory operand. This is quite tricky and almost nearly
   // handles the full generality of base/disp memory operands, with the ability
   // to mix in input virtual registers and immediates, as well as literal
   // registers and immediates for the various components.
-  void ParseCompoundMemoryOperand(void) {
+  void ParseCompoundMemoryOperand(bool has_segment) {
     enum {
       ParseReg,
       InterpretRegAsBase,
@@ -179,6 +290,8 @@ class InlineAssemblyParser {
       return;
     }
 
+    if (Peek('%') && TryParseAbsoluteMemoryOperand(has_segment)) return;
+
     for (; !Peek(']');) {
       switch (state) {
         case ParseReg:
@@ -328,21 +441,21 @@ class InlineAssemblyParser {
   void ParseMemoryOperand(void) {
     auto seg_reg = XED_REG_INVALID;
     if (Peek('[')) {
-      ParseCompoundMemoryOperand();
+      ParseCompoundMemoryOperand(false);
 
     } else if (Peek('F')) {
       ParseWord();
       GRANARY_ASSERT(StringsMatch(buff, "FS"));
       seg_reg = XED_REG_FS;
       Accept(':');
-      ParseCompoundMemoryOperand();
+      ParseCompoundMemoryOperand(true);
 
     } else if (Peek('G')) {
       ParseWord();
       GRANARY_ASSERT(StringsMatch(buff, "GS"));
       seg_reg = XED_REG_GS;
       Accept(':');
-      ParseCompoundMemoryOperand();
+      ParseCompoundMemoryOperand(true);
 
     } else if (Peek('%')) {
       auto var_num = ParseVar();
@@ -351,7 +464,12 @@ class InlineAssemblyParser {
         seg_reg = static_cast<xed_reg_enum_t>(aop->reg.EncodeToNative());
         GRANARY_ASSERT(seg_reg && XED_REG_DS != seg_reg);
         Accept(':');
-        ParseCompoundMemoryOperand();
+        ParseCompoundMemoryOperand(true);
+
+      // Treat an input immediate as the address of the memory.
+      } else if (aop->IsImmediate()) {
+        op->type = XED_ENCODER_OPERAND_TYPE_PTR;
+        op->addr.as_uint = aop->imm.as_uint;
       } else {
         GRANARY_ASSERT(aop->IsMemory());
         *op = *aop;
@@ -367,6 +485,49 @@ class InlineAssemblyParser {
     auto var_num = ParseVar();
     InitRegVar(var_num);
     *op = *(scope->vars[var_num]);
+    if (op == &(data.ops[0])) dest_var = var_num;
+  }
+
+  // Returns true if the second operand of the current instruction can be
+  // either a register or a sign-extended 32-bit immediate.
+  bool SourceCanBeImmediate(void) {
+    switch (data.iclass) {
+      case XED_ICLASS_ADC:
+      case XED_ICLASS_ADD:
+      case XED_ICLASS_AND:
+      case XED_ICLASS_CMP:
+      case XED_ICLASS_MOV:
+      case XED_ICLASS_OR:
+      case XED_ICLASS_SBB:
+      case XED_ICLASS_SUB:
+      case XED_ICLASS_TEST:
+      case XED_ICLASS_XOR:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // Try to specialize a read of a 64-bit register variable that is known to
+  // hold a small constant into an immediate operand, e.g. turn
+  // `MOV m64 [%1], r64 %3` into `MOV m64 [%1], i32 <value of %3>`.
+  bool TryParseConstantOperand(unsigned width) {
+    if (!FLAG_specialize_inline_assembly || 64 != width || num_immediates ||
+        op != &(data.ops[1]) || !SourceCanBeImmediate()) {
+      return false;
+    }
+    const auto var_ch = ch;
+    auto var_num = ParseVar();
+    auto value = constant_values[var_num];
+    if (!var_is_constant[var_num] || 32 < arch::ImmediateWidthBits(value)) {
+      ch = var_ch;
+      return false;
+    }
+    op->type = 0 > static_cast<int64_t>(value) ? XED_ENCODER_OPERAND_TYPE_SIMM0
+                                               : XED_ENCODER_OPERAND_TYPE_IMM0;
+    op->imm.as_uint = value;
+    num_immediates++;
+    return true;
   }
 
   // Parse an explicitly specified architectural register.
@@ -470,7 +631,13 @@ class InlineAssemblyParser {
     ConsumeWhiteSpace();
     switch (type) {
       case 'm': ParseMemoryOperand(); break;
-      case 'r': ParseRegisterOperand(width); break;
+      case 'r':
+        if (TryParseConstantOperand(width)) {
+          width = 32;
+        } else {
+          ParseRegisterOperand(width);
+        }
+        break;
       case 'i': ParseImmediateOperand(); break;
       case 'l': ParseLabelOperand(); break;
       default: GRANARY_ASSERT(false); break;
@@ -626,6 +793,7 @@ class InlineAssemblyParser {
     }
     Accept(';');
     MakeInstruction();
+    TrackConstants();
   }
 
  private:
@@ -692,8 +860,85 @@ class InlineAssemblyParser {
 
   // The number of immediates already seen.
   int num_immediates;
+
+  // The register variable that is the first operand of the current
+  // instruction, or `kMaxNumInlineVars` if there is no such variable.
+  unsigned dest_var;
+
+  // Register variables that are known to hold constants, and the values of
+  // those constants.
+  bool var_is_constant[kMaxNumInlineVars];
+  uint64_t constant_values[kMaxNumInlineVars];
+};
+
+
+enum : size_t {
+  // Number of virtual registers that can be allocated within a trace.
+  kNumTraceVirtualRegisters = kMinGlobalVirtualRegister -
+                              kMinTraceVirtualRegister
 };
 
+// Set of trace-local virtual registers, indexed by their numbers relative to
+// `kMinTraceVirtualRegister`.
+typedef BitSet<kNumTraceVirtualRegisters> TraceRegisterSet;
+
+// Returns true if `instr` moves a constant into a trace-local virtual
+// register.
+static bool IsConstantDefinition(const NativeInstruction *instr) {
+  const auto &ainstr(instr->instruction);
+  if (XED_ICLASS_MOV != ainstr.iclass) return false;
+  const auto &dest(ainstr.ops[0]);
+  if (!dest.IsRegister() || !dest.reg.IsVirtual() ||
+      dest.reg.IsStackPointerAlias() || !ainstr.ops[1].IsImmediate()) {
+    return false;
+  }
+  const auto reg_num = dest.reg.Number();
+  return kMinTraceVirtualRegister <= reg_num &&
+         kMinGlobalVirtualRegister > reg_num;
+}
+
+// Add the trace-local virtual registers used by `op` to `used_regs`.
+static void MarkUsedRegisters(const arch::Operand &op,
+                              TraceRegisterSet *used_regs) {
+  VirtualRegister regs[2];
+  for (auto i = arch::OperandRegisters(op, regs); i--; ) {
+    const auto reg = regs[i];
+    if (!reg.IsVirtual()) continue;
+    const auto reg_num = reg.Number();
+    if (kMinTraceVirtualRegister <= reg_num &&
+        kMinGlobalVirtualRegister > reg_num) {
+      used_regs->Set(static_cast<unsigned>(reg_num - kMinTraceVirtualRegister),
+                     true);
+    }
+  }
+}
+
+// Find every trace-local virtual register that is used by some instruction
+// of `cfg`, including by the arguments of not-yet-compiled inline function
+// calls. The destination operands of constant definitions don't count as
+// uses.
+static void FindUsedRegisters(Trace *cfg, TraceRegisterSet *used_regs) {
+  for (auto block : cfg->Blocks()) {
+    auto decoded_block = DynamicCast<DecodedBlock *>(block);
+    if (!decoded_block) continue;
+    for (auto instr : decoded_block->Instructions()) {
+      if (auto ninstr = DynamicCast<NativeInstruction *>(instr)) {
+        const auto &ainstr(ninstr->instruction);
+        auto i = IsConstantDefinition(ninstr) ? 1UL : 0UL;
+        for (; i < ainstr.num_ops; ++i) {
+          MarkUsedRegisters(ainstr.ops[i], used_regs);
+        }
+      } else if (auto annot = DynamicCast<AnnotationInstruction *>(instr)) {
+        if (kAnnotInlineFunctionCall != annot->annotation) continue;
+        auto call = annot->Data<InlineFunctionCall *>();
+        for (auto i = 0UL; i < call->NumArguments(); ++i) {
+          MarkUsedRegisters(*(call->args[i].Extract()), used_regs);
+        }
+      }
+    }
+  }
+}
+
 }  // namespace
 namespace arch {
 
@@ -710,5 +955,30 @@ void CompileInlineAssemblyBlock(Trace *cfg,
   parser.ParseInstructions();
 }
 
+// Remove `MOV`s of constants into virtual registers, where the virtual
+// registers are never used. These are left behind when every use of a
+// constant is specialized into an immediate or absolute memory operand.
+void RemoveUnusedConstants(Trace *cfg) {
+  TraceRegisterSet used_regs;
+  FindUsedRegisters(cfg, &used_regs);
+  for (auto block : cfg->Blocks()) {
+    auto decoded_block = DynamicCast<DecodedBlock *>(block);
+    if (!decoded_block) continue;
+
+    granary::Instruction *next_instr(nullptr);
+    for (auto instr = decoded_block->FirstInstruction(); instr;
+         instr = next_instr) {
+      next_instr = instr->Next();
+      auto ninstr = DynamicCast<NativeInstruction *>(instr);
+      if (!ninstr || !IsConstantDefinition(ninstr)) continue;
+      const auto reg_num = ninstr->instruction.ops[0].reg.Number();
+      if (!used_regs.Get(
+              static_cast<unsigned>(reg_num - kMinTraceVirtualRegister))) {
+        granary::Instruction::Unlink(ninstr);
+      }
+    }
+  }
+}
+
 }  // namespace arch
 }  // namespace granary
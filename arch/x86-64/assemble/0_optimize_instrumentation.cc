@@ -0,0 +1,635 @@
+/* Copyright 2014 Peter Goodman, all rights reserved. */
+
+#define GRANARY_INTERNAL
+#define GRANARY_ARCH_INTERNAL
+
+#include "arch/x86-64/builder.h"
+#include "arch/x86-64/instruction.h"
+
+#include "granary/base/tiny_vector.h"
+
+#include "granary/cfg/block.h"
+#include "granary/cfg/instruction.h"
+
+#include "granary/breakpoint.h"
+
+namespace granary {
+namespace arch {
+
+// Table mapping each iclass to the set of read and written flags by *any*
+// selection of that iclass.
+extern const FlagsSet IFORM_FLAGS[];
+
+namespace {
+
+enum : size_t {
+  // Maximum number of registers whose values are tracked at any one time.
+  MAX_NUM_TRACKED_REGS = 16,
+
+  // Maximum number of labels that can simultaneously be the targets of
+  // forward branches whose values we are tracking.
+  MAX_NUM_PENDING_LABELS = 4,
+
+  // Number of inputs to a value expression.
+  MAX_NUM_EXPRESSION_INPUTS = 6
+};
+
+// Identifies some value computed by an instruction. Value numbers are only
+// meaningful within a single block, and the value number `0` represents an
+// unknown value.
+typedef uint32_t ValueNumber;
+
+// Associates a register with the value that it currently holds. The value
+// number always describes the full-width register.
+struct RegisterValue {
+  VirtualRegister reg;
+  ValueNumber value;
+};
+
+// The known values of registers and of the flags at some point in a block.
+struct ValueState {
+  RegisterValue regs[MAX_NUM_TRACKED_REGS];
+  size_t num_regs;
+  ValueNumber flags;
+  bool is_reachable;
+};
+
+// An expression computed by a pure instruction. Two instructions compute the
+// same value if they have the same form, width, and input values.
+struct ValueExpression {
+  inline bool operator==(const ValueExpression &that) const {
+    if (iform != that.iform || width != that.width) return false;
+    for (auto i = 0UL; i < MAX_NUM_EXPRESSION_INPUTS; ++i) {
+      if (inputs[i] != that.inputs[i]) return false;
+    }
+    return true;
+  }
+
+  xed_iform_enum_t iform;
+  size_t width;
+  uint64_t inputs[MAX_NUM_EXPRESSION_INPUTS];
+  ValueNumber value;
+};
+
+// Known values on entry to a label that is targeted by forward branches.
+struct PendingLabel {
+  LabelInstruction *label;
+  uintptr_t num_branches;
+  ValueState state;
+};
+
+// Returns true if an annotation has no effect on the values of registers or
+// on the flags.
+static bool IsBenignAnnotation(const AnnotationInstruction *instr) {
+  switch (instr->annotation) {
+    case kAnnotNoOp:
+    case kAnnotBeginBlock:
+    case kAnnotEndBlock:
+    case kAnnotationCodeCacheKind:
+    case kAnnotInvalidStack:
+    case kAnnotCondLeaveNativeStack:
+    case kAnnotCondEnterNativeStack:
+    case kAnnotLogicalInstructionBoundary:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Returns true if `reg` is a 32- or 64-bit GPR whose value can be tracked.
+static bool IsTrackedRegister(VirtualRegister reg) {
+  return reg.IsGeneralPurpose() && !reg.IsStackPointer() &&
+         !reg.IsStackPointerAlias() &&
+         (32 == reg.BitWidth() || 64 == reg.BitWidth());
+}
+
+// Returns true if `op` is a register operand that can be tracked.
+static bool IsTrackedRegister(const Operand &op) {
+  return op.IsRegister() && IsTrackedRegister(op.reg);
+}
+
+// Returns true if `reg` can be used in an effective address that we track.
+static bool IsTrackedAddressRegister(VirtualRegister reg) {
+  return IsTrackedRegister(reg) && 64 == reg.BitWidth();
+}
+
+// Returns true if `op` is an effective address that can be value numbered.
+static bool IsTrackedEffectiveAddress(const Operand &op) {
+  if (!op.IsEffectiveAddress()) return false;
+  if (op.IsPointer()) return true;
+  if (!op.IsCompoundMemory()) return IsTrackedAddressRegister(op.reg);
+  if (op.mem.base.IsValid() && !IsTrackedAddressRegister(op.mem.base)) {
+    return false;
+  }
+  return !op.mem.index.IsValid() || IsTrackedAddressRegister(op.mem.index);
+}
+
+// Returns true if `instr` computes a value (or the flags) purely from its
+// register and immediate operands. Such instructions can be removed if the
+// value they compute is already available.
+static bool IsPureInstruction(const NativeInstruction *instr) {
+  const auto &ainstr(instr->instruction);
+  if (instr->IsAppInstruction() || !ainstr.WillBeEncoded()) return false;
+  switch (ainstr.iclass) {
+    case XED_ICLASS_MOV:
+    case XED_ICLASS_LEA:
+    case XED_ICLASS_SHL:
+    case XED_ICLASS_SHR:
+    case XED_ICLASS_SAR:
+    case XED_ICLASS_ADD:
+    case XED_ICLASS_SUB:
+    case XED_ICLASS_AND:
+    case XED_ICLASS_OR:
+    case XED_ICLASS_XOR:
+    case XED_ICLASS_BT:
+    case XED_ICLASS_TEST:
+    case XED_ICLASS_CMP:
+      break;
+    default:
+      return false;
+  }
+  if (ainstr.has_prefix_lock || ainstr.has_prefix_rep ||
+      ainstr.has_prefix_repne || ainstr.is_atomic || ainstr.is_sticky ||
+      ainstr.is_stack_blind) {
+    return false;
+  }
+  if (2 != ainstr.num_explicit_ops) return false;
+  if (!IsTrackedRegister(ainstr.ops[0])) return false;
+
+  const auto &src(ainstr.ops[1]);
+  if (src.IsRegister()) return IsTrackedRegister(src);
+  if (src.IsImmediate()) return !src.IsBranchTarget();
+  if (src.IsMemory()) {
+    return XED_ICLASS_LEA == ainstr.iclass && IsTrackedEffectiveAddress(src);
+  }
+  return false;
+}
+
+// Returns true if `instr` is a full-width copy of one register into another.
+static bool IsRegisterCopy(const Instruction &ainstr) {
+  return XED_ICLASS_MOV == ainstr.iclass && ainstr.ops[1].IsRegister() &&
+         64 == ainstr.ops[0].BitWidth() && 64 == ainstr.ops[1].BitWidth();
+}
+
+// Returns true if none of the flags written by `instr` are read by a later
+// instrumentation instruction before being overwritten.
+static bool FlagsAreDead(NativeInstruction *instr) {
+  auto flags = IFORM_FLAGS[instr->instruction.iform].written.flat;
+  for (auto next = instr->Next(); next; next = next->Next()) {
+    if (auto ninstr = DynamicCast<NativeInstruction *>(next)) {
+
+      // Application instructions only ever observe the application's flags,
+      // which are saved and restored around instrumentation code.
+      if (ninstr->IsAppInstruction()) return true;
+
+      const auto &next_flags(IFORM_FLAGS[ninstr->instruction.iform]);
+      if (next_flags.read.flat & flags) return false;
+
+      // Conservatively assume that the flags are live in the targets of
+      // branches.
+      if (IsA<BranchInstruction *>(ninstr) ||
+          IsA<ControlFlowInstruction *>(ninstr)) {
+        return false;
+      }
+      flags &= ~next_flags.written.flat;
+      if (!flags) return true;
+
+    } else if (auto annot = DynamicCast<AnnotationInstruction *>(next)) {
+      if (!IsBenignAnnotation(annot)) return false;  // E.g. labels.
+    }
+  }
+  return false;
+}
+
+// Performs local value numbering on the instructions of a block. Values are
+// propagated along the fall-through path, as well as along forward branches
+// to labels within the block, so long as all branches to a label are known.
+//
+// Note: Addresses that only differ in their displacements, e.g. `[rbx+8]` and
+//       `[rbx+16]`, are different values, and so checks on them (e.g. of the
+//       watched bit) are not merged, because a carry out of the displacement
+//       can change the checked bits. Instead, tools share such checks by
+//       instrumenting groups of memory operands with a common base register
+//       (see `AddMemOpGroupInstrumenter`).
+class ValueNumberer {
+ public:
+  ValueNumberer(void)
+      : next_value(1),
+        state(),
+        pending(),
+        exprs() {
+    Reset();
+  }
+
+  void Reset(void) {
+    state.num_regs = 0;
+    state.flags = 0;
+    state.is_reachable = true;
+  }
+
+  // Number the values of the instructions in `block`, removing or simplifying
+  // instructions that recompute known values.
+  void NumberValues(DecodedBlock *block) {
+    granary::Instruction *next_instr(nullptr);
+    for (auto instr = block->FirstInstruction(); instr; instr = next_instr) {
+      next_instr = instr->Next();
+      if (auto label = DynamicCast<LabelInstruction *>(instr)) {
+        VisitLabel(label);
+      } else if (auto annot = DynamicCast<AnnotationInstruction *>(instr)) {
+        if (!IsBenignAnnotation(annot)) Reset();
+      } else if (auto ninstr = DynamicCast<NativeInstruction *>(instr)) {
+        VisitInstruction(ninstr);
+      }
+    }
+  }
+
+ private:
+  // Find the tracked value of a register.
+  static RegisterValue *Find(ValueState *vals, VirtualRegister reg) {
+    for (auto i = 0UL; i < vals->num_regs; ++i) {
+      if (vals->regs[i].reg == reg) return &(vals->regs[i]);
+    }
+    return nullptr;
+  }
+
+  // Stop tracking the value of a register.
+  static void Kill(ValueState *vals, VirtualRegister reg) {
+    for (auto i = 0UL; i < vals->num_regs; ++i) {
+      if (vals->regs[i].reg == reg) {
+        vals->regs[i] = vals->regs[--vals->num_regs];
+        return;
+      }
+    }
+  }
+
+  // Keep only the values that are the same in both `vals` and `other`.
+  static void Intersect(ValueState *vals, ValueState *other) {
+    for (auto i = 0UL; i < vals->num_regs; ) {
+      auto reg_val = Find(other, vals->regs[i].reg);
+      if (reg_val && reg_val->value == vals->regs[i].value) {
+        ++i;
+      } else {
+        Kill(vals, vals->regs[i].reg);
+      }
+    }
+    if (vals->flags != other->flags) vals->flags = 0;
+  }
+
+  // Update the value of a register.
+  void Update(VirtualRegister reg, ValueNumber value) {
+    if (auto reg_val = Find(&state, reg)) {
+      reg_val->value = value;
+      return;
+    }
+    // Forget about the least recently tracked register if we're full.
+    if (MAX_NUM_TRACKED_REGS == state.num_regs) {
+      for (auto i = 1UL; i < MAX_NUM_TRACKED_REGS; ++i) {
+        state.regs[i - 1] = state.regs[i];
+      }
+      --state.num_regs;
+    }
+    auto &reg_val(state.regs[state.num_regs++]);
+    reg_val.reg = reg;
+    reg_val.value = value;
+  }
+
+  // Get the current value of a register. If the value is not known then a
+  // new value number is assigned.
+  ValueNumber ValueOf(VirtualRegister reg) {
+    if (auto reg_val = Find(&state, reg)) return reg_val->value;
+    auto value = next_value++;
+    Update(reg, value);
+    return value;
+  }
+
+  // Find a register other than `except` that holds `value`.
+  RegisterValue *FindHolder(ValueNumber value, VirtualRegister except) {
+    for (auto i = 0UL; i < state.num_regs; ++i) {
+      auto &reg_val(state.regs[i]);
+      if (reg_val.value == value && reg_val.reg != except) return &reg_val;
+    }
+    return nullptr;
+  }
+
+  // Get the value number of an expression, assigning a new value number if
+  // the expression has not been seen before.
+  ValueNumber ValueOf(ValueExpression *expr) {
+    for (const auto &seen_expr : exprs) {
+      if (seen_expr == *expr) return seen_expr.value;
+    }
+    expr->value = next_value++;
+    exprs.Append(*expr);
+    return expr->value;
+  }
+
+  // Describe the value computed by a pure instruction.
+  void DescribeExpression(const Instruction &ainstr, ValueExpression *expr) {
+    const auto &dest(ainstr.ops[0]);
+    const auto &src(ainstr.ops[1]);
+    memset(expr, 0, sizeof *expr);
+    expr->iform = ainstr.iform;
+    expr->width = dest.BitWidth();
+    if (dest.IsRead()) expr->inputs[0] = ValueOf(dest.reg);
+    if (src.IsRegister()) {
+      expr->inputs[1] = ValueOf(src.reg);
+      expr->inputs[2] = src.BitWidth();
+    } else if (src.IsImmediate()) {
+      expr->inputs[1] = src.imm.as_uint;
+      expr->inputs[2] = src.BitWidth();
+    } else if (src.IsPointer()) {
+      expr->inputs[1] = src.addr.as_uint;
+      expr->inputs[5] = 1;
+    } else if (!src.IsCompoundMemory()) {
+      expr->inputs[1] = ValueOf(src.reg);
+      expr->inputs[5] = 2;
+    } else {
+      if (src.mem.base.IsValid()) expr->inputs[1] = ValueOf(src.mem.base);
+      if (src.mem.index.IsValid()) expr->inputs[2] = ValueOf(src.mem.index);
+      expr->inputs[3] = static_cast<uint64_t>(src.mem.disp);
+      expr->inputs[4] = src.mem.scale;
+      expr->inputs[5] = 3;
+    }
+  }
+
+  // Forget the values of all registers and flags written by an instruction
+  // that we can't value number.
+  void Clobber(const Instruction &ainstr) {
+    for (auto i = 0UL; i < ainstr.num_ops; ++i) {
+      const auto &op(ainstr.ops[i]);
+      if (op.IsRegister() && (op.IsWrite() || op.IsConditionalWrite())) {
+        Kill(&state, op.reg);
+      }
+    }
+    if (ainstr.WritesFlags()) state.flags = 0;
+  }
+
+  // Value number a pure instruction. This might remove the instruction, or
+  // replace it with a register copy.
+  void VisitPureInstruction(NativeInstruction *instr) {
+    auto &ainstr(instr->instruction);
+    const auto dest = ainstr.ops[0].reg;
+    ValueExpression expr;
+
+    // Only computes the flags, e.g. `BT`, `TEST`, or `CMP`. If the flags
+    // already hold the result of the same check then the check is redundant.
+    if (!ainstr.ops[0].IsWrite()) {
+      DescribeExpression(ainstr, &expr);
+      const auto value = ValueOf(&expr);
+      if (value == state.flags) {
+        granary::Instruction::Unlink(instr);
+      } else {
+        state.flags = value;
+      }
+      return;
+    }
+
+    ValueNumber value(0);
+    if (IsRegisterCopy(ainstr)) {
+      value = ValueOf(ainstr.ops[1].reg);
+    } else {
+      DescribeExpression(ainstr, &expr);
+      value = ValueOf(&expr);
+    }
+
+    if (!ainstr.WritesFlags() || FlagsAreDead(instr)) {
+
+      // The destination register already holds the computed value.
+      if (auto dest_val = Find(&state, dest)) {
+        if (dest_val->value == value) {
+          granary::Instruction::Unlink(instr);
+          return;
+        }
+      }
+
+      // Some other register holds the computed value; copy it instead of
+      // recomputing it.
+      if (!IsRegisterCopy(ainstr)) {
+        if (auto holder = FindHolder(value, dest)) {
+          MOV_GPRv_GPRv_89(&ainstr, dest.WidenedTo(GPR_WIDTH_BYTES),
+                           holder->reg.WidenedTo(GPR_WIDTH_BYTES));
+          ainstr.ops[0].is_definition = true;
+          Update(dest, value);
+          return;
+        }
+      }
+    }
+    if (ainstr.WritesFlags()) state.flags = value;
+    Update(dest, value);
+  }
+
+  // Value number an instruction, and record the known values on entry to
+  // the targets of any local branches.
+  void VisitInstruction(NativeInstruction *instr) {
+    if (IsPureInstruction(instr)) {
+      VisitPureInstruction(instr);
+      return;
+    }
+    Clobber(instr->instruction);
+
+    // The application's flags are restored before every application
+    // instruction, so the instrumentation's flags don't survive it.
+    if (instr->IsAppInstruction()) state.flags = 0;
+
+    if (auto branch = DynamicCast<BranchInstruction *>(instr)) {
+      VisitBranch(branch->TargetLabel());
+      if (branch->IsUnconditionalJump()) {
+        Reset();
+        state.is_reachable = false;
+      }
+    } else if (auto cfi = DynamicCast<ControlFlowInstruction *>(instr)) {
+      if (!cfi->IsConditionalJump()) Reset();
+    }
+  }
+
+  // Find the pending state for some label.
+  PendingLabel *FindPending(LabelInstruction *label) {
+    for (auto &pending_label : pending) {
+      if (pending_label.label == label) return &pending_label;
+    }
+    return nullptr;
+  }
+
+  // Record the values known at a branch to `label`. If we run out of space
+  // then the label's branch count won't match, and so nothing will be assumed
+  // about the values on entry to the label.
+  void VisitBranch(LabelInstruction *label) {
+    if (auto pending_label = FindPending(label)) {
+      Intersect(&(pending_label->state), &state);
+      pending_label->num_branches += 1;
+    } else if (auto free_label = FindPending(nullptr)) {
+      free_label->label = label;
+      free_label->num_branches = 1;
+      free_label->state = state;
+    }
+  }
+
+  // Merge the values known from all branches targeting `label` with the
+  // fall-through values.
+  void VisitLabel(LabelInstruction *label) {
+    auto pending_label = FindPending(label);
+    auto num_branches = pending_label ? pending_label->num_branches : 0UL;
+    if (num_branches != label->Data<uintptr_t>()) {
+      Reset();
+    } else if (pending_label) {
+      if (state.is_reachable) {
+        Intersect(&state, &(pending_label->state));
+      } else {
+        state = pending_label->state;
+      }
+    }
+    if (pending_label) pending_label->label = nullptr;
+    state.is_reachable = true;
+  }
+
+  // Next value number to assign.
+  ValueNumber next_value;
+
+  // Values known at the current instruction.
+  ValueState state;
+
+  // Values known on entry to labels targeted by forward branches.
+  PendingLabel pending[MAX_NUM_PENDING_LABELS];
+
+  // All expressions seen so far in the block.
+  TinyVector<ValueExpression, 8> exprs;
+
+  GRANARY_DISALLOW_COPY_AND_ASSIGN(ValueNumberer);
+};
+
+// Returns the number of operands of `ainstr` that use `reg`.
+static size_t CountRegisterUses(const Instruction &ainstr,
+                                VirtualRegister reg) {
+  auto num_uses = 0UL;
+  for (auto i = 0UL; i < ainstr.num_ops; ++i) {
+    if (OperandUsesRegister(ainstr.ops[i], reg)) ++num_uses;
+  }
+  return num_uses;
+}
+
+// Returns true if `ainstr` writes to `reg`.
+static bool WritesToRegister(const Instruction &ainstr, VirtualRegister reg) {
+  if (!reg.IsValid()) return false;
+  for (auto i = 0UL; i < ainstr.num_ops; ++i) {
+    const auto &op(ainstr.ops[i]);
+    if (op.IsRegister() && op.reg == reg &&
+        (op.IsWrite() || op.IsConditionalWrite())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns true if `instr` is an `LEA` of a compound address into a virtual
+// register, e.g. as introduced by early mangling.
+static bool IsFoldableAddressComputation(const NativeInstruction *instr) {
+  const auto &ainstr(instr->instruction);
+  if (XED_ICLASS_LEA != ainstr.iclass) return false;
+
+  const auto &dest(ainstr.ops[0]);
+  const auto &addr(ainstr.ops[1]);
+  if (!dest.IsRegister() || !dest.reg.IsVirtual() ||
+      dest.reg.IsStackPointerAlias() || 64 != dest.reg.BitWidth()) {
+    return false;
+  }
+
+  // Stack pointer-relative addresses are kept separate so that their
+  // displacements can be adjusted if virtual registers are spilled to the
+  // stack, and PC-relative addresses need to be re-relativized.
+  if (!addr.is_compound) return false;
+  for (auto reg : {addr.mem.base, addr.mem.index}) {
+    if (reg.IsStackPointer() || reg.IsStackPointerAlias() ||
+        reg.IsInstructionPointer()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Find the sole use of the address computed by `lea`. The use must be a
+// non-compound memory operand in a later instruction of the same straight-
+// line sequence of instructions, and the registers used by the address must
+// not change between `lea` and the use.
+static Operand *FindFoldableUse(NativeInstruction *lea) {
+  const auto &addr(lea->instruction.ops[1]);
+  const auto addr_reg = lea->instruction.ops[0].reg;
+
+  for (auto next = lea->Next(); next; next = next->Next()) {
+    if (auto annot = DynamicCast<AnnotationInstruction *>(next)) {
+      if (!IsBenignAnnotation(annot)) return nullptr;  // E.g. labels.
+      continue;
+    }
+    auto ninstr = DynamicCast<NativeInstruction *>(next);
+    if (!ninstr) return nullptr;
+    if (IsA<BranchInstruction *>(ninstr) ||
+        IsA<ControlFlowInstruction *>(ninstr)) {
+      return nullptr;
+    }
+
+    auto &ainstr(ninstr->instruction);
+    if (auto num_uses = CountRegisterUses(ainstr, addr_reg)) {
+      if (1 != num_uses) return nullptr;
+      for (auto i = 0U; i < ainstr.num_explicit_ops; ++i) {
+        auto &op(ainstr.ops[i]);
+        if (XED_ENCODER_OPERAND_TYPE_MEM == op.type && !op.is_compound &&
+            !op.is_sticky && op.reg == addr_reg) {
+          return &op;
+        }
+      }
+      return nullptr;
+    }
+    if (WritesToRegister(ainstr, addr.mem.base) ||
+        WritesToRegister(ainstr, addr.mem.index)) {
+      return nullptr;
+    }
+  }
+  return nullptr;
+}
+
+// Returns true if `reg` is used by any instruction in `block` other than
+// `lea` and `user`.
+static bool HasOtherUses(DecodedBlock *block, const NativeInstruction *lea,
+                         const Operand *use, VirtualRegister reg) {
+  for (auto instr : block->Instructions()) {
+    if (instr == lea) continue;
+    if (auto ninstr = DynamicCast<NativeInstruction *>(instr)) {
+      const auto &ainstr(ninstr->instruction);
+      for (auto i = 0UL; i < ainstr.num_ops; ++i) {
+        const auto &op(ainstr.ops[i]);
+        if (&op != use && OperandUsesRegister(op, reg)) return true;
+      }
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+// Eliminate redundant instrumentation instructions from `block` by value
+// numbering the instructions of the block.
+void EliminateRedundantInstructions(DecodedBlock *block) {
+  ValueNumberer numberer;
+  numberer.NumberValues(block);
+}
+
+// Fold `LEA`s of compound addresses into virtual registers back into the
+// memory operands that use them, if nothing else (e.g. instrumentation) uses
+// the computed address.
+void FoldAddressComputations(DecodedBlock *block) {
+  granary::Instruction *next_instr(nullptr);
+  for (auto instr = block->FirstInstruction(); instr; instr = next_instr) {
+    next_instr = instr->Next();
+    auto lea = DynamicCast<NativeInstruction *>(instr);
+    if (!lea || !IsFoldableAddressComputation(lea)) continue;
+
+    auto use = FindFoldableUse(lea);
+    const auto addr_reg = lea->instruction.ops[0].reg;
+    if (!use || HasOtherUses(block, lea, use, addr_reg)) continue;
+
+    use->mem = lea->instruction.ops[1].mem;
+    use->is_compound = true;
+    granary::Instruction::Unlink(lea);
+  }
+}
+
+}  // namespace arch
+}  // namespace granary
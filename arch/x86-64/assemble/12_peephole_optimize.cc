@@ -0,0 +1,121 @@
+/* Copyright 2015 Peter Goodman, all rights reserved. */
+
+#define GRANARY_INTERNAL
+#define GRANARY_ARCH_INTERNAL
+
+#include "arch/x86-64/instruction.h"
+
+#include "granary/cfg/instruction.h"
+
+#include "granary/code/fragment.h"
+
+namespace granary {
+namespace arch {
+namespace {
+
+// Returns true if two register operands name the same native register, with
+// the same width.
+static bool SameRegister(const Operand &a, const Operand &b) {
+  return a.IsRegister() && b.IsRegister() &&
+         a.reg.EncodeToNative() == b.reg.EncodeToNative();
+}
+
+// Returns true if two memory operands access the same memory.
+static bool SameMemory(const Operand &a, const Operand &b) {
+  if (a.type != b.type || a.width != b.width || a.segment != b.segment) {
+    return false;
+  }
+  if (XED_ENCODER_OPERAND_TYPE_PTR == a.type) {
+    return a.addr.as_uint == b.addr.as_uint;
+  } else if (XED_ENCODER_OPERAND_TYPE_MEM != a.type ||
+             a.is_compound != b.is_compound) {
+    return false;
+  } else if (!a.is_compound) {
+    return a.reg.EncodeToNative() == b.reg.EncodeToNative();
+  }
+  return a.mem.base.EncodeToNative() == b.mem.base.EncodeToNative() &&
+         a.mem.index.EncodeToNative() == b.mem.index.EncodeToNative() &&
+         a.mem.disp == b.mem.disp && a.mem.scale == b.mem.scale;
+}
+
+// Returns true if the address of the memory operand `op` depends on `reg`.
+static bool AddressUsesRegister(const Operand &op, VirtualRegister reg) {
+  if (XED_ENCODER_OPERAND_TYPE_MEM != op.type) return false;
+  if (!op.is_compound) return op.reg == reg;
+  return op.mem.base == reg || op.mem.index == reg;
+}
+
+// Returns true if `instr` is a Granary-introduced `MOV` (e.g. a spill or fill)
+// that can be removed.
+static bool IsRemovableMov(const NativeInstruction *instr) {
+  const auto &ainstr(instr->instruction);
+  return XED_ICLASS_MOV == ainstr.iclass && ainstr.WillBeEncoded() &&
+         !instr->IsAppInstruction();
+}
+
+// Returns true if `instr` is a `MOV r, r`. Moves between the same 32-bit
+// registers are not no-ops, as they zero the high-order 32 bits.
+static bool IsSelfMove(const NativeInstruction *instr) {
+  const auto &ainstr(instr->instruction);
+  return IsRemovableMov(instr) && SameRegister(ainstr.ops[0], ainstr.ops[1]) &&
+         32 != ainstr.ops[0].BitWidth();
+}
+
+// Returns true if `second` undoes `first`, i.e. `first` stores a register to
+// memory and `second` loads it back, or `first` loads a register from memory
+// and `second` stores it back to the same place.
+static bool IsRedundantMovPair(const NativeInstruction *first,
+                               const NativeInstruction *second) {
+  if (!IsRemovableMov(first) || !IsRemovableMov(second)) return false;
+  const auto &a(first->instruction);
+  const auto &b(second->instruction);
+  if (a.ops[0].IsRegister()) {
+    return SameRegister(a.ops[0], b.ops[1]) && SameMemory(a.ops[1], b.ops[0]) &&
+           !AddressUsesRegister(a.ops[1], a.ops[0].reg);
+  } else {
+    return SameRegister(a.ops[1], b.ops[0]) && SameMemory(a.ops[0], b.ops[1]);
+  }
+}
+
+// Returns true if `second` restores the flags to the values that `first`
+// just saved, i.e. `LAHF; SAHF`.
+static bool IsRedundantFlagsRestore(const NativeInstruction *first,
+                                    const NativeInstruction *second) {
+  return XED_ICLASS_LAHF == first->instruction.iclass &&
+         XED_ICLASS_SAHF == second->instruction.iclass &&
+         first->instruction.WillBeEncoded() &&
+         !first->IsAppInstruction() && !second->IsAppInstruction();
+}
+
+}  // namespace
+
+// Removes redundant instructions from the fragment `frag`. Returns the number
+// of instructions that will no longer be encoded.
+size_t PeepholeOptimize(Fragment *frag) {
+  auto num_removed = 0UL;
+  NativeInstruction *prev(nullptr);
+  for (auto instr : InstructionListIterator(frag->instrs)) {
+    if (IsA<LabelInstruction *>(instr)) {  // Might be a branch target.
+      prev = nullptr;
+      continue;
+    }
+    auto ninstr = DynamicCast<NativeInstruction *>(instr);
+    if (!ninstr || !ninstr->instruction.WillBeEncoded()) continue;
+    if (ninstr == frag->branch_instr || ninstr == frag->fall_through_instr) {
+      prev = nullptr;
+      continue;
+    }
+    if (IsSelfMove(ninstr) ||
+        (prev && (IsRedundantMovPair(prev, ninstr) ||
+                  IsRedundantFlagsRestore(prev, ninstr)))) {
+      ninstr->instruction.DontEncode();
+      ++num_removed;
+      continue;
+    }
+    prev = ninstr;
+  }
+  return num_removed;
+}
+
+}  // namespace arch
+}  // namespace granary
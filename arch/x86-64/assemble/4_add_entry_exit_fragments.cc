@@ -3,10 +3,15 @@
 #define GRANARY_INTERNAL
 #define GRANARY_ARCH_INTERNAL
 
+#include "arch/decode.h"
+
+#include "arch/x86-64/builder.h"
 #include "arch/x86-64/instruction.h"
 
 #include "granary/code/fragment.h"
 
+#include "os/module.h"
+
 namespace granary {
 namespace arch {
 
@@ -64,5 +69,96 @@ uint32_t AllArithmeticFlags(void) {
   */
 }
 
+// Returns a bitmap representing the arithmetic flags that are live on entry
+// to the application instruction located at `pc`. We only look at a single
+// instruction: if it reads a flag then that flag is live, if it
+// unconditionally writes a flag then that flag is dead, and otherwise we
+// conservatively treat the flag as live.
+uint32_t AppEntryLiveFlags(AppPC pc) {
+  auto all_flags = AllArithmeticFlags();
+  if (!os::ModuleContainingPC(pc)) return all_flags;
+
+  Instruction instr;
+  if (!InstructionDecoder::Decode(&instr, pc)) return all_flags;
+
+  FlagUsageInfo flags;
+  flags.entry_live_flags = all_flags;
+  VisitInstructionFlags(instr, &flags);
+  return flags.entry_live_flags & all_flags;
+}
+
+namespace {
+
+// Returns `true` if `reg` can be used as the base/index register of an
+// effective address computation that replaces an arithmetic instruction.
+static bool IsFlagFreeConvertibleReg(VirtualRegister reg) {
+  if (!reg.IsGeneralPurpose()) return false;
+  if (reg.IsStackPointer() || reg.IsStackPointerAlias()) return false;
+  return arch::DOUBLEWORD_WIDTH_BITS <= reg.BitWidth();
+}
+
+// Convert `dest += disp` into `LEA dest, [dest + disp]`.
+static void ConvertToLEA(Instruction *instr, VirtualRegister dest,
+                         int32_t disp) {
+  auto base = dest.WidenedTo(arch::ADDRESS_WIDTH_BYTES);
+  LEA_GPRv_AGEN(instr, dest,
+                BaseDispMemOp(disp, base, arch::ADDRESS_WIDTH_BITS));
+}
+
+}  // namespace
+
+// Try to convert an instrumentation instruction that writes to the flags into
+// an equivalent instruction that does not write to the flags. Returns `true`
+// if the instruction was converted.
+//
+// Note: The width of the destination register is at least 32 bits, so the
+//       upper bits of the (widened) base register don't matter: the low 32
+//       bits of the effective address are the same as the low 32 bits of the
+//       original arithmetic, and writing to a 32-bit register zero-extends.
+bool TryConvertToFlagFreeInstruction(Instruction *instr) {
+  if (instr->has_prefix_lock || instr->is_sticky) return false;
+
+  const auto &dest_op(instr->ops[0]);
+  if (!dest_op.IsRegister()) return false;
+  auto dest = dest_op.reg;
+  if (!IsFlagFreeConvertibleReg(dest)) return false;
+
+  auto is_64_bit = arch::GPR_WIDTH_BITS == dest.BitWidth();
+  switch (instr->iform) {
+    case XED_IFORM_ADD_GPRv_IMMb:
+    case XED_IFORM_ADD_GPRv_IMMz:
+    case XED_IFORM_SUB_GPRv_IMMb:
+    case XED_IFORM_SUB_GPRv_IMMz: {
+      auto imm = instr->ops[1].imm.as_int;
+      if (XED_ICLASS_SUB == instr->iclass) imm = -imm;
+      if (is_64_bit && (INT32_MIN > imm || INT32_MAX < imm)) return false;
+      ConvertToLEA(instr, dest, static_cast<int32_t>(imm));
+      return true;
+    }
+
+    case XED_IFORM_INC_GPRv_40:
+    case XED_IFORM_INC_GPRv_FFr0:
+      ConvertToLEA(instr, dest, 1);
+      return true;
+
+    case XED_IFORM_DEC_GPRv_48:
+    case XED_IFORM_DEC_GPRv_FFr1:
+      ConvertToLEA(instr, dest, -1);
+      return true;
+
+    case XED_IFORM_ADD_GPRv_GPRv_01:
+    case XED_IFORM_ADD_GPRv_GPRv_03: {
+      auto src = instr->ops[1].reg;
+      if (!IsFlagFreeConvertibleReg(src)) return false;
+      LEA_GPRv_AGEN(instr, dest, dest.WidenedTo(arch::ADDRESS_WIDTH_BYTES),
+                    src.WidenedTo(arch::ADDRESS_WIDTH_BYTES));
+      return true;
+    }
+
+    default:
+      return false;
+  }
+}
+
 }  // namespace arch
 }  // namespace granary
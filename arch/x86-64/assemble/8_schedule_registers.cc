@@ -13,6 +13,7 @@
 #include "granary/code/fragment.h"
 
 #include "granary/breakpoint.h"
+#include "granary/stats.h"
 
 namespace granary {
 namespace arch {
@@ -27,6 +28,7 @@ NativeInstruction *SaveGPRToSlot(VirtualRegister gpr,
   slot.Widen(arch::ADDRESS_WIDTH_BYTES);
   arch::MOV_MEMv_GPRv(&ninstr, slot, gpr);
   ninstr.ops[0].width = arch::GPR_WIDTH_BITS;
+  AddStat(kStatNumSpills);
   return new NativeInstruction(&ninstr);
 }
 
@@ -40,6 +42,7 @@ NativeInstruction *RestoreGPRFromSlot(VirtualRegister gpr,
   slot.Widen(arch::ADDRESS_WIDTH_BYTES);
   arch::MOV_GPRv_MEMv(&ninstr, gpr, slot);
   ninstr.ops[1].width = arch::GPR_WIDTH_BITS;
+  AddStat(kStatNumFills);
   return new NativeInstruction(&ninstr);
 }
 
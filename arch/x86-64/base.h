@@ -27,8 +27,9 @@ enum {
   INLINE_CALL_CODE_SIZE_BYTES = 128,
 
   // Upper bound on the size of edge-specific direct edge code. Ideally this
-  // should be as small as possible.
-  DIRECT_EDGE_CODE_SIZE_BYTES = GRANARY_IF_KERNEL_ELSE(32, 48),
+  // should be as small as possible. This includes the execution counting code
+  // that is added if `--profile_direct_edges` is enabled.
+  DIRECT_EDGE_CODE_SIZE_BYTES = GRANARY_IF_KERNEL_ELSE(48, 64),
 
   // This is the size of the edge "entrypoint" code. This code is targeted by
   // edge code in order to get into Granary.
@@ -54,8 +54,19 @@ void GenerateInlineCallCode(Callback *callback, size_t num_args) {
   InstructionEncoder commit_enc(InstructionEncodeKind::COMMIT);
   auto pc = callback->wrapped_callback;
 
-  // Save the flags.
-  ENC(PUSHFQ(&ni); ni.effective_operand_width = arch::GPR_WIDTH_BITS; );
+  // Save the flags. In kernel space we need `PUSHFQ` so that the interrupt
+  // flag is restored by `POPFQ`. In user space, `RAX` is saved first, and then
+  // the arithmetic flags are stored in `AH` (`LAHF`) and `AL` (`SETO`) and
+  // pushed. Both variants push two quadwords in total, so the stack alignment
+  // on entry to the callback is the same.
+  if (GRANARY_IF_USER_ELSE(true, false)) {
+    ENC(PUSH_GPRv_50(&ni, XED_REG_RAX); );
+    ENC(SETO_GPR8(&ni, XED_REG_AL); );
+    ENC(LAHF(&ni); );
+    ENC(PUSH_GPRv_50(&ni, XED_REG_RAX); );
+  } else {
+    ENC(PUSHFQ(&ni); ni.effective_operand_width = arch::GPR_WIDTH_BITS; );
+  }
 
   // Disable interrupts and swap stacks.
   if (GRANARY_IF_USER_ELSE(false, true)) {
@@ -64,7 +75,7 @@ void GenerateInlineCallCode(Callback *callback, size_t num_args) {
   }
 
   // Save the GPRs.
-  ENC(PUSH_GPRv_50(&ni, XED_REG_RAX); );
+  if (GRANARY_IF_USER_ELSE(false, true)) ENC(PUSH_GPRv_50(&ni, XED_REG_RAX); );
   if (4 > num_args) ENC(PUSH_GPRv_50(&ni, XED_REG_RCX); );
   if (3 > num_args) ENC(PUSH_GPRv_50(&ni, XED_REG_RDX); );
   ENC(PUSH_GPRv_50(&ni, XED_REG_RBX); );
@@ -98,15 +109,23 @@ void GenerateInlineCallCode(Callback *callback, size_t num_args) {
   ENC(POP_GPRv_51(&ni, XED_REG_RBX); );
   if (3 > num_args) ENC(POP_GPRv_51(&ni, XED_REG_RDX); );
   if (4 > num_args) ENC(POP_GPRv_51(&ni, XED_REG_RCX); );
-  ENC(POP_GPRv_51(&ni, XED_REG_RAX); );
+  if (GRANARY_IF_USER_ELSE(false, true)) ENC(POP_GPRv_51(&ni, XED_REG_RAX); );
 
   // Swap back to the application stack.
   if (GRANARY_IF_USER_ELSE(false, true)) {
     ENC(XCHG_MEMv_GPRv(&ni, SlotMemOp(os::SLOT_PRIVATE_STACK), XED_REG_RSP));
   }
 
-  // Restore the flags (and potentially interrupts).
-  ENC(POPFQ(&ni); ni.effective_operand_width = arch::GPR_WIDTH_BITS; );
+  // Restore the flags (and potentially interrupts). Adding `0x7F` to `AL` sets
+  // `OF` iff `AL` is `1`, and `SAHF` then restores the remaining flags.
+  if (GRANARY_IF_USER_ELSE(true, false)) {
+    ENC(POP_GPRv_51(&ni, XED_REG_RAX); );
+    ENC(ADD_GPR8_IMMb_80r0(&ni, XED_REG_AL, static_cast<uint8_t>(0x7F)); );
+    ENC(SAHF(&ni); );
+    ENC(POP_GPRv_51(&ni, XED_REG_RAX); );
+  } else {
+    ENC(POPFQ(&ni); ni.effective_operand_width = arch::GPR_WIDTH_BITS; );
+  }
 
   ENC(RET_NEAR(&ni); ni.effective_operand_width = arch::GPR_WIDTH_BITS; );
 
@@ -98,7 +98,11 @@ static void MangleExplicitMemOp(EarlyMangler *mangler, Operand &op) {
     }
 
     auto mem_reg = mangler->AllocateVirtualRegister();
-    if (op.mem.base.IsStackPointer()) mem_reg.MarkAsStackPointerAlias();
+    if (op.mem.base.IsStackPointer()) {
+      mem_reg.MarkAsStackPointerAlias();
+    } else if (VirtualRegister::FramePointer() == op.mem.base) {
+      mem_reg.MarkAsFramePointerAlias();
+    }
 
     Instruction ni;
     LEA_GPRv_AGEN(&ni, mem_reg, op);
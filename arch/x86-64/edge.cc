@@ -11,6 +11,7 @@
 #include "arch/x86-64/register.h"
 
 #include "granary/base/base.h"
+#include "granary/base/option.h"
 
 #include "granary/cfg/block.h"
 #include "granary/cfg/trace.h"
@@ -32,12 +33,43 @@
     GRANARY_ASSERT(ret); \
   } while (0)
 
+// Save the flags. In user space, the arithmetic flags are stored into `AH`
+// (`LAHF`) and `AL` (`SETO`), and `RAX` is pushed before and after. The
+// `granary_arch_enter_*_edge` functions don't use `RAX` as an input.
+#define ENC_SAVE_FLAGS() \
+  do { \
+    if (GRANARY_IF_USER_ELSE(true, false)) { \
+      ENC(PUSH_GPRv_50(&ni, XED_REG_RAX); ); \
+      ENC(SETO_GPR8(&ni, XED_REG_AL); ); \
+      ENC(LAHF(&ni); ); \
+      ENC(PUSH_GPRv_50(&ni, XED_REG_RAX); ); \
+    } else { \
+      ENC(PUSHFQ(&ni); ni.effective_operand_width = arch::GPR_WIDTH_BITS; ); \
+    } \
+  } while (0)
+
+// Restore the flags saved by `ENC_SAVE_FLAGS`. Adding `0x7F` to `AL` sets `OF`
+// iff `AL` is `1`, and `SAHF` then restores the remaining arithmetic flags.
+#define ENC_RESTORE_FLAGS() \
+  do { \
+    if (GRANARY_IF_USER_ELSE(true, false)) { \
+      ENC(POP_GPRv_51(&ni, XED_REG_RAX); ); \
+      ENC(ADD_GPR8_IMMb_80r0(&ni, XED_REG_AL, static_cast<uint8_t>(0x7F)); ); \
+      ENC(SAHF(&ni); ); \
+      ENC(POP_GPRv_51(&ni, XED_REG_RAX); ); \
+    } else { \
+      ENC(POPFQ(&ni); ni.effective_operand_width = arch::GPR_WIDTH_BITS; ); \
+    } \
+  } while (0)
+
 #define APP(edge, ...) \
   do { \
     __VA_ARGS__ ; \
     edge->instrs.Append(new NativeInstruction(&ni)); \
   } while (0)
 
+GRANARY_DECLARE_bool(profile_direct_edges);
+
 extern "C" {
 
 // The direct edge entrypoint code.
@@ -61,8 +93,10 @@ void GenerateDirectEdgeEntryCode(CachePC pc) {
   InstructionEncoder commit_enc(InstructionEncodeKind::COMMIT);
   GRANARY_IF_DEBUG( const auto start_pc = pc; )
 
-  // Save the flags.
-  ENC(PUSHFQ(&ni); ni.effective_operand_width = arch::GPR_WIDTH_BITS; );
+  // Save the flags. In kernel space we need `PUSHFQ` so that the interrupt
+  // flag is restored by `POPFQ`. In user space we only need the arithmetic
+  // flags, which are cheaper to save with `SETO` and `LAHF`.
+  ENC_SAVE_FLAGS();
 
   // Disable interrupts and swap stacks.
   if (GRANARY_IF_USER_ELSE(false, true)) {
@@ -80,7 +114,7 @@ void GenerateDirectEdgeEntryCode(CachePC pc) {
   }
 
   // Restore the flags, and potentially re-enable interrupts.
-  ENC(POPFQ(&ni); ni.effective_operand_width = arch::GPR_WIDTH_BITS; );
+  ENC_RESTORE_FLAGS();
 
   // Return back into the edge code.
   ENC(RET_NEAR(&ni); ni.effective_operand_width = arch::ADDRESS_WIDTH_BITS; );
@@ -98,6 +132,22 @@ Fragment *GenerateDirectEdgeCode(DirectEdge *edge) {
   Instruction ni;
   frag->instrs.Append(new AnnotationInstruction(kAnnotUpdateAddressWhenEncoded,
                                                 &(edge->edge_code_pc)));
+
+  // Count the number of times this edge code is executed. The increment is
+  // done with `LEA` so that the application's flags are left untouched. The
+  // count is not atomic; it only needs to be approximate.
+  if (FLAG_profile_direct_edges) {
+    frag->instrs.Append(new AnnotationInstruction(kAnnotCondLeaveNativeStack));
+    APP(frag, PUSH_GPRv_50(&ni, XED_REG_RAX); ni.is_stack_blind = true; );
+    APP(frag, MOV_GPRv_MEMv(&ni, XED_REG_RAX, &(edge->num_executions)));
+    APP(frag, LEA_GPRv_AGEN(&ni, XED_REG_RAX,
+                            BaseDispMemOp(1, XED_REG_RAX,
+                                          arch::ADDRESS_WIDTH_BITS)));
+    APP(frag, MOV_MEMv_GPRv(&ni, &(edge->num_executions), XED_REG_RAX));
+    APP(frag, POP_GPRv_51(&ni, XED_REG_RAX); ni.is_stack_blind = true; );
+    frag->instrs.Append(new AnnotationInstruction(kAnnotCondEnterNativeStack));
+  }
+
   // The first time this is executed, it will jump to the next instruction,
   // which also agrees with prefetching and predicting of unknown branches.
   // After the target block is translated, we will update `entry_target_pc`
@@ -147,8 +197,10 @@ void GenerateIndirectEdgeEntryCode(CachePC pc) {
   InstructionEncoder commit_enc(InstructionEncodeKind::COMMIT);
   GRANARY_IF_DEBUG( const auto start_pc = pc; )
 
-  // Save the flags and potentially disable interrupts.
-  ENC(PUSHFQ(&ni); ni.effective_operand_width = arch::GPR_WIDTH_BITS; );
+  // Save the flags. In kernel space we need `PUSHFQ` so that the interrupt
+  // flag is restored by `POPFQ`. In user space we only need the arithmetic
+  // flags, which are cheaper to save with `SETO` and `LAHF`.
+  ENC_SAVE_FLAGS();
 
   if (GRANARY_IF_USER_ELSE(false, true)) {
     // Disable interrupts and swap onto Granary's private stack.
@@ -167,7 +219,7 @@ void GenerateIndirectEdgeEntryCode(CachePC pc) {
 
   // Restore the flags, and potentially re-enable interrupts. After this
   // instruction, it is reasonably likely that we will hit an interrupt.
-  ENC(POPFQ(&ni); ni.effective_operand_width = arch::GPR_WIDTH_BITS; );
+  ENC_RESTORE_FLAGS();
 
   // Return back into the in-edge code.
   ENC(RET_NEAR(&ni); ni.effective_operand_width = arch::ADDRESS_WIDTH_BITS; );
@@ -410,5 +462,51 @@ bool TryAtomicPatchEdge(DirectEdge *edge) {
   return true;
 }
 
+// Canonical 5-byte `NOP`, i.e. `NOP DWORD PTR [RAX + RAX * 1 + 0]`.
+static const uint8_t kNop5[JMP_RELBRd_SIZE_BYTES] = {
+  0x0F, 0x1F, 0x44, 0x00, 0x00
+};
+
+// Returns the address of the instruction that immediately follows the
+// instruction patched by `edge`, if that instruction is a direct `JMP`.
+// Returns `nullptr` otherwise.
+//
+// Note: This function has an architecture-specific implementation.
+CachePC FallThroughChainPC(const DirectEdge *edge) {
+  Instruction ni;
+  auto pc = edge->patch_instruction_pc;
+  if (!pc || !InstructionDecoder::Decode(&ni, pc)) return nullptr;
+  if (XED_ICLASS_JMP != ni.iclass || ni.HasIndirectTarget() ||
+      JMP_RELBRd_SIZE_BYTES != ni.decoded_length) {
+    return nullptr;
+  }
+  return pc + JMP_RELBRd_SIZE_BYTES;
+}
+
+// Elide the direct `JMP` patched by `edge` by replacing it with a `NOP`. This
+// is used when the target of the `JMP` was placed immediately after it.
+//
+// Note: This function has an architecture-specific implementation.
+bool TryElideChainedJump(DirectEdge *edge) {
+  auto pc = edge->patch_instruction_pc;
+  GRANARY_ASSERT(edge->entry_target_pc == FallThroughChainPC(edge));
+
+  // The `NOP` is written with a single 8-byte store, which must not cross two
+  // cache lines.
+  auto addr = reinterpret_cast<uintptr_t>(pc);
+  auto start_cl = addr / CACHE_LINE_SIZE_BYTES;
+  auto end_cl = (addr + sizeof(uint64_t) - 1) / CACHE_LINE_SIZE_BYTES;
+  if (start_cl != end_cl) return false;
+
+  CodeCacheTransaction transaction;
+  uint64_t itext(0);
+  memcpy(&itext, pc, sizeof itext);
+  memcpy(&itext, &(kNop5[0]), sizeof kNop5);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  *reinterpret_cast<uint64_t *>(pc) = itext;
+  std::atomic_thread_fence(std::memory_order_release);
+  return true;
+}
+
 }  // namespace arch
 }  // namespace granary
@@ -43,6 +43,9 @@ extern uint32_t AllArithmeticFlags(void);
 // Initialize the block tracer.
 extern void InitBlockTracer(void);
 
+// Initialize the instruction selection cache.
+extern void InitSelectionCache(void);
+
 namespace {
 
 // Number of pages allocates to hold the table of implicit operands.
@@ -591,6 +594,7 @@ void Init(void) {
   InitIclassTables();
   InitIclassFlags();
   InitIformFlags();
+  InitSelectionCache();
   InitOperandTables();
   InitVirtualRegs();
   InitBlockTracer();
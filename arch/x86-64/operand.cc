@@ -156,6 +156,26 @@ bool MemoryOperand::MatchSegmentRegister(VirtualRegister &reg) const {
   return false;
 }
 
+// Try to match this memory operand as a base register plus a constant
+// displacement, e.g. `[RBX + 16]`. Non-compound register memory operands are
+// matched with a displacement of `0`.
+bool MemoryOperand::MatchBaseAndDisplacement(VirtualRegister &base,
+                                             intptr_t &disp) const {
+  if (XED_ENCODER_OPERAND_TYPE_MEM != op->type) return false;
+  if (XED_REG_INVALID != op->segment && XED_REG_DS != op->segment) {
+    return false;
+  }
+  if (op->is_compound) {
+    if (!op->mem.base.IsValid() || op->mem.index.IsValid()) return false;
+    base = op->mem.base;
+    disp = op->mem.disp;
+  } else {
+    base = op->reg;
+    disp = 0;
+  }
+  return true;
+}
+
 // Try to match this memory operand as a register value. That is, the address
 // is stored in the matched register.
 size_t MemoryOperand::CountMatchedRegisters(
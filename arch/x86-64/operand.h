@@ -197,6 +197,33 @@ static_assert(offsetof(Operand, reg) == offsetof(Operand, mem.base),
 static_assert(sizeof(Operand) <= 32,
     "Invalid structure packing of `granary::arch::Operand`.");
 
+// Fills `regs` with the registers that `op` reads or writes, either directly
+// or as part of an address. Returns the number of registers in `regs`.
+inline static size_t OperandRegisters(const Operand &op,
+                                      VirtualRegister (&regs)[2]) {
+  if (op.IsRegister() ||
+      (XED_ENCODER_OPERAND_TYPE_MEM == op.type && !op.is_compound)) {
+    regs[0] = op.reg;
+    return 1;
+  } else if (XED_ENCODER_OPERAND_TYPE_MEM == op.type) {
+    regs[0] = op.mem.base;
+    regs[1] = op.mem.index;
+    return 2;
+  }
+  return 0;
+}
+
+// Returns true if `op` reads or writes `reg`, either directly or as part of
+// an address.
+inline static bool OperandUsesRegister(const Operand &op,
+                                       VirtualRegister reg) {
+  VirtualRegister regs[2];
+  for (auto i = OperandRegisters(op, regs); i--; ) {
+    if (regs[i] == reg) return true;
+  }
+  return false;
+}
+
 // Returns true if an implicit operand is ambiguous. An implicit operand is
 // ambiguous if there are multiple encodings for the same iclass, and the given
 // operand (indexed by `op`) is explicit for some iforms but not others.
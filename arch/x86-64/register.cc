@@ -326,6 +326,25 @@ void LiveRegisterSet::Visit(const arch::Operand *op) {
   }
 }
 
+// Update this register tracker by marking all registers written by an
+// instruction.
+void WrittenRegisterSet::Visit(const arch::Instruction *instr) {
+  GRANARY_ASSERT(XED_IFORM_INVALID != instr->iform);
+  GRANARY_ASSERT(0 != instr->isel);
+  for (auto i = 0U; i < instr->num_ops; ++i) {
+    Visit(&(instr->ops[i]));
+  }
+}
+
+// Update this register tracker by marking a written register operand.
+//
+// Note: Partial and conditional writes are treated as writes.
+void WrittenRegisterSet::Visit(const arch::Operand *op) {
+  if (op->IsRegister() && op->IsWrite()) {
+    Revive(op->reg);
+  }
+}
+
 namespace arch {
 
 VirtualRegister REG_RFLAGS;
@@ -150,16 +150,102 @@ int MatchOperandTypes(const Instruction *instr, const xed_inst_t *xedi) {
   return score;
 }
 
+enum : uint64_t {
+  // Number of cached selections per iclass.
+  kNumCachedSelections = 4,
+
+  // Instructions with more explicit operands than this aren't cached.
+  kMaxNumCachedOperands = 3,
+
+  // Number of bits used to summarize each explicit operand in a selection
+  // signature. This is 5 bits for the operand kind and width, and 9 bits for
+  // the register.
+  kOperandSignatureBits = 14,
+  kMaxOperandRegister = 1 << 9,
+
+  // A cached selection packs a 44-bit signature and a 16-bit offset of
+  // the selection from `ICLASS_SELECTIONS[iclass]`. Offsets are stored plus
+  // one, so that zero represents an empty entry.
+  kSelectionOffsetBits = 16,
+  kMaxSelectionOffset = (1 << kSelectionOffsetBits) - 1
+};
+
+// Cache of recent selections, indexed by iclass. `MatchOperandTypes` only
+// looks at the kind, width, and register of each explicit operand, so a
+// selection can be reused for any instruction of the same iclass whose
+// explicit operands have the same kinds, widths, and registers.
+static std::atomic<uint64_t> gSelectionCache[XED_ICLASS_LAST]
+                                            [kNumCachedSelections];
+
+// Summarizes the kind and width of an operand into a number in `[0, 30)`.
+static uint64_t OperandKindAndWidth(const Operand &op) {
+  uint64_t kind = 0;
+  if (op.IsRegister()) kind = 1;
+  else if (op.IsMemory()) kind = 2;
+  else if (op.IsBranchTarget()) kind = 3;
+  else if (op.IsImmediate()) kind = 4;
+
+  uint64_t width = 5;
+  switch (op.BitWidth()) {
+    case 0: width = 0; break;
+    case 8: width = 1; break;
+    case 16: width = 2; break;
+    case 32: width = 3; break;
+    case 64: width = 4; break;
+    default: break;
+  }
+  return kind * 6 + width;
+}
+
+// Computes the signature of the explicit operands of `instr`, as seen by
+// `MatchOperandTypes`. Returns `false` if the instruction can't be
+// summarized.
+static bool SelectionSignature(const Instruction *instr, uint64_t *sig) {
+  if (kMaxNumCachedOperands < instr->num_explicit_ops) return false;
+  uint64_t signature = instr->num_explicit_ops;
+  for (auto i = 0U; i < instr->num_explicit_ops; ++i) {
+    const auto &op(instr->ops[i]);
+    uint64_t reg = 0;
+    if (op.IsRegister()) {
+      reg = op.reg.EncodeToNative();
+      if (kMaxOperandRegister <= reg) return false;
+    }
+    signature = (signature << kOperandSignatureBits) |
+                (OperandKindAndWidth(op) << 9) | reg;
+  }
+  *sig = signature;
+  return true;
+}
+
+// Hashes a signature into one of the cached selections of an iclass.
+static std::atomic<uint64_t> &CachedSelection(xed_iclass_enum_t iclass,
+                                              uint64_t signature) {
+  auto hash = (signature * 0x9E3779B97F4A7C15ULL) >> 62;
+  return gSelectionCache[iclass][hash % kNumCachedSelections];
+}
+
 }  // namespace
 
+// Initialize the instruction selection cache.
+void InitSelectionCache(void) {
+  for (auto &selections : gSelectionCache) {
+    for (auto &selection : selections) {
+      selection.store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
 // Returns the `xed_inst_t` instance associated with this instruction. This
 // won't necessarily return a perfect selection. That is, all that is required
 // of the returned selection is that the types of the operands match
 // (independent of the sizes of operands).
 const xed_inst_t *SelectInstruction(Instruction *instr) {
-  auto xedi = ICLASS_SELECTIONS[instr->iclass];
+  auto first_xedi = ICLASS_SELECTIONS[instr->iclass];
+  auto xedi = first_xedi;
   int max_score = kBadSelectionScore;
   const xed_inst_t *max_xedi(nullptr);
+  std::atomic<uint64_t> *cached_selection(nullptr);
+  uint64_t signature(0);
 
   // Special case for `LEA`.
   if (GRANARY_UNLIKELY(XED_ICLASS_LEA == instr->iclass)) {
@@ -167,6 +253,17 @@ const xed_inst_t *SelectInstruction(Instruction *instr) {
     goto select_xedi;
   }
 
+  // Try to re-use a previous selection.
+  if (GRANARY_LIKELY(SelectionSignature(instr, &signature))) {
+    cached_selection = &(CachedSelection(instr->iclass, signature));
+    auto selection = cached_selection->load(std::memory_order_relaxed);
+    if ((selection >> kSelectionOffsetBits) == signature &&
+        (selection & kMaxSelectionOffset)) {
+      max_xedi = first_xedi + (selection & kMaxSelectionOffset) - 1;
+      goto select_xedi;
+    }
+  }
+
   // Try to find the best matching instruction.
   for (; xedi < LAST_ICLASS_SELECTION; ++xedi) {
     if (xed_inst_iclass(xedi) != instr->iclass) break;
@@ -177,6 +274,15 @@ const xed_inst_t *SelectInstruction(Instruction *instr) {
     }
   }
 
+  // Remember this selection.
+  if (cached_selection && max_xedi) {
+    auto offset = static_cast<uint64_t>(max_xedi - first_xedi) + 1;
+    if (kMaxSelectionOffset > offset) {
+      cached_selection->store((signature << kSelectionOffsetBits) | offset,
+                              std::memory_order_relaxed);
+    }
+  }
+
 select_xedi:
   GRANARY_ASSERT(nullptr != max_xedi);
   instr->iform = xed_inst_iform_enum(max_xedi);  // Update in-place.
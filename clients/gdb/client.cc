@@ -99,7 +99,9 @@ class GDBDebuggerHelper : public InstrumentationTool {
   // attached.
   static void Init(InitReason reason) {
     if (kInitThread == reason) return;
-    if (!FLAG_debug_gdb_prompt) AddSystemCallEntryFunction(SuppressSigAction);
+    if (!FLAG_debug_gdb_prompt) {
+      AddSystemCallEntryFunction(SuppressSigAction, {__NR_rt_sigaction});
+    }
   }
 
   // Returns true if the target of a native basic block is known to be an
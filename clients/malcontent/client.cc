@@ -55,7 +55,17 @@ GRANARY_DEFINE_bool(collect_memop_stats, false,
     "   2)  Static count: Number of ignored memory operands (due to\n"
     "       training).\n"
     "   3)  Dynamic counts of (1) and (2).\n"
-    "   4)  Total number of samples taken.",
+    "   4)  Total number of samples taken.\n"
+    "   5)  The cost of changing sample points, in cycles.",
+
+    "malcontent");
+
+GRANARY_DEFINE_bool(adaptive_sampling, true,
+    "Should Malcontent adapt how it samples to the contention that it has "
+    "observed? If enabled, then every sampled offset of types that recently "
+    "showed contention is sampled, whereas only one rotating offset of other "
+    "types is sampled. The sample rate is also backed off (up to 8x "
+    "`--sample_rate`) while no contention is observed. The default is `yes`.",
 
     "malcontent");
 
@@ -128,7 +138,25 @@ enum : size_t {
   kNumUsableSamplePoints = kNumSamplePoints - 1UL,
 
   // How big of a stack trace should be recorder per sample?
-  kSampleStackTraceSize = 5UL
+  kSampleStackTraceSize = 5UL,
+
+  // Number of sample point sets. One set is active, and the other is either
+  // being drained of readers, or being populated.
+  kNumSamplePointSets = 2UL,
+
+  // Number of counters used to track the readers of a sample point set.
+  // Readers are spread across these so that they don't all contend on the
+  // same cache line.
+  kNumReaderCountersLog2 = 4UL,
+  kNumReaderCounters = 1UL << kNumReaderCountersLog2,
+
+  // Maximum factor by which the sample rate is backed off when no contention
+  // is observed.
+  kMaxSampleRateBackoff = 8UL,
+
+  // Maximum "heat" of a type. Types heat up when contention is detected on
+  // them, and cool down every sampling period.
+  kMaxTypeHeat = 8U
 };
 
 // Shadow memory for ownership tracking.
@@ -318,11 +346,38 @@ static std::atomic<size_t> gNextAllocationIndex = ATOMIC_VAR_INIT(0);
 static std::atomic<void *> gRecentAllocations[kNumSamplePoints] \
     = {ATOMIC_VAR_INIT(nullptr)};
 
-// Set of active sample points.
-static SamplePoint gSamplePoints[kNumSamplePoints];
+// Counts the number of threads reading from a sample point set.
+struct alignas(arch::CACHE_LINE_SIZE_BYTES) ReaderCounter {
+  std::atomic<uint64_t> num_readers;
+};
+
+// Sets of sample points. Instrumentation code only reads from the active set,
+// and never takes a lock. The monitor thread populates the inactive set, makes
+// it the active set, and then waits for all readers of the previously active
+// set to drain before it reports on and clears the old set.
+static SamplePoint gSamplePointSets[kNumSamplePointSets][kNumSamplePoints];
+
+// Index of the active sample point set.
+static std::atomic<size_t> gActiveSamplePointSet = ATOMIC_VAR_INIT(0);
+
+// Readers of each sample point set.
+static ReaderCounter gSamplePointReaders[kNumSamplePointSets]
+                                        [kNumReaderCounters];
+
+// Per-type heat, indexed by type ID. This is only accessed by the monitor
+// thread.
+static uint8_t gTypeHeat[kNumUsableSamplePoints] = {0};
 
-// Lock guarding the `gSamplePoints` array.
-static ReaderWriterLock gSamplePointsLock;
+// Number of sampling periods so far. This is used to rotate which offset of
+// a cold type gets sampled.
+static uint64_t gSamplingPeriod = 0;
+
+// Statistics about the cost of sampling. These are only updated if
+// `--collect_memop_stats` is used.
+static std::atomic<uint64_t> gNumSamplesTaken = ATOMIC_VAR_INIT(0);
+static std::atomic<uint64_t> gNumContentionChecks = ATOMIC_VAR_INIT(0);
+static std::atomic<uint64_t> gMonitorCycles = ATOMIC_VAR_INIT(0);
+static std::atomic<uint64_t> gGracePeriodCycles = ATOMIC_VAR_INIT(0);
 
 // The PID of the monitor thread.
 static pid_t gMonitorThread = -1;
@@ -445,23 +500,95 @@ WRAP_NATIVE_FUNCTION(libc, posix_memalign, (int), (void **addr_ptr,
 // TODO(pag): Don't handle `realloc` at the moment because we have no idea what
 //            type id it should be associated with.
 
-static void ClearActiveSamplePoints(void) {
-  memset(&(gSamplePoints[0]), 0, sizeof gSamplePoints);
+// Returns the reader counter to be used by the current thread.
+static ReaderCounter &ReaderCounterFor(size_t set) {
+  auto hash = static_cast<uint64_t>(os::ThreadBase()) * 0x9E3779B97F4A7C15ULL;
+  return gSamplePointReaders[set][hash >> (64 - kNumReaderCountersLog2)];
+}
+
+// Registers the current thread as a reader of the active sample point set for
+// the lifetime of this object. This never blocks the monitor thread, nor is
+// it blocked by the monitor thread.
+class SamplePointSetReader {
+ public:
+  SamplePointSetReader(void) {
+    for (;;) {
+      set = gActiveSamplePointSet.load();
+      counter = &(ReaderCounterFor(set));
+      counter->num_readers.fetch_add(1);
+      if (GRANARY_LIKELY(set == gActiveSamplePointSet.load())) break;
+
+      // Raced with the monitor thread changing the active set.
+      counter->num_readers.fetch_sub(1);
+    }
+  }
+
+  ~SamplePointSetReader(void) {
+    counter->num_readers.fetch_sub(1, std::memory_order_release);
+  }
+
+  SamplePoint &operator[](size_t sample_id) const {
+    return gSamplePointSets[set][sample_id];
+  }
+
+ private:
+  size_t set;
+  ReaderCounter *counter;
+
+  GRANARY_DISALLOW_COPY_AND_ASSIGN(SamplePointSetReader);
+};
+
+// Wait for all readers of a sample point set to drain.
+static void WaitForReaders(size_t set) {
+  const timespec pause_time = {0, 1000000L};
+  for (const auto &counter : gSamplePointReaders[set]) {
+    while (counter.num_readers.load(std::memory_order_acquire)) {
+      nanosleep(&pause_time, nullptr);
+    }
+  }
+}
+
+static void ClearSamplePoints(size_t set) {
+  memset(&(gSamplePointSets[set][0]), 0, sizeof gSamplePointSets[set]);
+}
+
+static void ClearAllSamplePoints(void) {
+  memset(&(gSamplePointSets[0][0]), 0, sizeof gSamplePointSets);
+  memset(gTypeHeat, 0, sizeof gTypeHeat);
+  gActiveSamplePointSet.store(0);
+  gSamplingPeriod = 0;
 }
 
 // Populates the sample point structures for each sampled address. This does
 // *not* activate the sample points (i.e. add watchpoints) until after all
 // sample points have been chosen.
-static void AddSamplesForAlloc(Allocation alloc, size_t &num_sample_points) {
+//
+// All offsets of hot objects are sampled, whereas only one offset (rotating
+// every sampling period) of a cold object is sampled.
+static void AddSamplesForAlloc(SamplePoint *samples, Allocation alloc,
+                               size_t &num_sample_points, bool is_hot) {
   auto alloc_addr = alloc.pointer;
   if (!alloc_addr) return;
 
-  auto tracker = ShadowOf<OwnershipTracker>(alloc_addr);
+  const auto object_size = SizeOfType(alloc.type_id);
   const auto base_address = reinterpret_cast<uintptr_t>(alloc_addr);
-  const auto limit_address = base_address + SizeOfType(alloc.type_id);
+  const auto limit_address = base_address + object_size;
+  auto begin_offset = 0UL;
+  auto end_offset = object_size;
+
+  if (!is_hot) {
+    auto num_offsets = (object_size + FLAG_shadow_granularity - 1) /
+                       FLAG_shadow_granularity;
+    begin_offset = (gSamplingPeriod % GRANARY_MAX(num_offsets, 1UL)) *
+                   FLAG_shadow_granularity;
+    end_offset = begin_offset + 1;
+  }
 
-  for (auto offset_in_object = 0UL;
-       num_sample_points < FLAG_num_sample_points;
+  auto tracker = ShadowOf<OwnershipTracker>(alloc_addr) +
+                 (begin_offset / FLAG_shadow_granularity);
+  for (auto offset_in_object = begin_offset;
+       num_sample_points < FLAG_num_sample_points &&
+       offset_in_object < end_offset;
        offset_in_object += FLAG_shadow_granularity) {
 
     const auto native_address = base_address + offset_in_object;
@@ -469,7 +596,7 @@ static void AddSamplesForAlloc(Allocation alloc, size_t &num_sample_points) {
 
     auto sample_tracker = tracker++;
     auto sample_id = num_sample_points++;
-    auto &sample(gSamplePoints[sample_id]);
+    auto &sample(samples[sample_id]);
 
     sample.type_id = alloc.type_id;
     sample.tracker = sample_tracker;
@@ -483,21 +610,37 @@ static void AddSamplesForAlloc(Allocation alloc, size_t &num_sample_points) {
   }
 }
 
-// Samples up to `FLAG_num_sample_points` object trackers.
-static void ActivateSamplePoints(void) {
-  // Add the sample points.
+// Returns `true` if an allocation is of a type that has recently shown
+// contention.
+static bool IsHotAllocation(Allocation alloc) {
+  return !FLAG_adaptive_sampling || gTypeHeat[alloc.type_id];
+}
+
+// Populates the sample point set `set` with up to `FLAG_num_sample_points`
+// object trackers. Hot allocations are sampled before cold ones. Returns the
+// number of sample points in the set, plus one.
+static size_t PopulateSamplePoints(size_t set) {
+  auto samples = gSamplePointSets[set];
   auto num_samples = 1UL;
-  for (auto i = 0UL;
-       i < FLAG_num_sample_points && num_samples <= FLAG_num_sample_points;
-       ++i) {
-    Allocation alloc;
-    alloc.pointer = gRecentAllocations[i].load();
-    AddSamplesForAlloc(alloc, num_samples);
+  for (auto want_hot : {true, false}) {
+    for (auto i = 0UL;
+         i < FLAG_num_sample_points && num_samples <= FLAG_num_sample_points;
+         ++i) {
+      Allocation alloc;
+      alloc.pointer = gRecentAllocations[i].load();
+      auto is_hot = IsHotAllocation(alloc);
+      if (is_hot != want_hot) continue;
+      AddSamplesForAlloc(samples, alloc, num_samples, is_hot);
+    }
+    if (!FLAG_adaptive_sampling) break;
   }
+  return num_samples;
+}
 
-  // Activate the sample points.
+// Activates the first `num_samples - 1` sample points of the set `set`.
+static void ActivateSamplePoints(size_t set, size_t num_samples) {
   for (auto sample_id = 1UL; sample_id < num_samples; ++sample_id) {
-    const auto &sample(gSamplePoints[sample_id]);
+    const auto &sample(gSamplePointSets[set][sample_id]);
     auto tracker = sample.tracker;
     if (tracker->value == sample_id) {
       tracker->value = 0;
@@ -559,54 +702,122 @@ static void LogSamplePoint(const SamplePoint &sample) {
   LogMemoryAccess(sample.accesses[1]);
 }
 
-// Logs memory access information for detected sources of contention.
-static void LogSamplePoints(void) {
-  for (const auto &sample : gSamplePoints) {
-    if (!sample.tracker) continue;  // Not activated.
+// Returns `true` if a sample point observed contention.
+static bool SampleIsContended(const SamplePoint &sample) {
+  if (!sample.tracker) return false;  // Not activated.
 
-    // Incomplete.
-    if (!sample.accesses[0].address || !sample.accesses[1].address) continue;
+  // Incomplete.
+  if (!sample.accesses[0].address || !sample.accesses[1].address) {
+    return false;
+  }
 
-    // Read/read, assume no contention.
-    if (!sample.accesses[0].location.is_write &&
-        !sample.accesses[1].location.is_write) {
-      continue;
-    }
+  // Read/read, assume no contention.
+  if (!sample.accesses[0].location.is_write &&
+      !sample.accesses[1].location.is_write) {
+    return false;
+  }
 
-    // Atomic/atomic, assume no contention.
-    if (sample.accesses[0].location.is_atomic &&
-        sample.accesses[1].location.is_atomic) {
-      continue;
-    }
+  // Atomic/atomic, assume no contention.
+  if (sample.accesses[0].location.is_atomic &&
+      sample.accesses[1].location.is_atomic) {
+    return false;
+  }
 
-    // Different cache lines.
-    const auto shadow_mask = ~(FLAG_shadow_granularity - 1UL);
-    auto a0 = reinterpret_cast<uintptr_t>(sample.accesses[0].address);
-    auto a1 = reinterpret_cast<uintptr_t>(sample.accesses[1].address);
-    if ((a0 & shadow_mask) != (a1 & shadow_mask)) continue;
+  // Different cache lines.
+  const auto shadow_mask = ~(FLAG_shadow_granularity - 1UL);
+  auto a0 = reinterpret_cast<uintptr_t>(sample.accesses[0].address);
+  auto a1 = reinterpret_cast<uintptr_t>(sample.accesses[1].address);
+  return (a0 & shadow_mask) == (a1 & shadow_mask);
+}
 
+// Logs memory access information for detected sources of contention, and
+// heats up the types of contended sample points. Returns `true` if any
+// contention was detected.
+static bool LogSamplePoints(size_t set) {
+  auto found_contention = false;
+  for (const auto &sample : gSamplePointSets[set]) {
+    if (!SampleIsContended(sample)) continue;
     LogSamplePoint(sample);
+    gTypeHeat[sample.type_id] = kMaxTypeHeat;
+    found_contention = true;
+  }
+  return found_contention;
+}
+
+// Cool down every type by one degree.
+static void CoolTypes(void) {
+  for (auto &heat : gTypeHeat) {
+    if (heat) --heat;
   }
 }
 
-// Monitor thread changes the sample point every FLAG_sample_rate milliseconds.
+// Returns a `timespec` representing `ms` milliseconds.
+static timespec SampleTime(uint64_t ms) {
+  return {static_cast<time_t>(ms / 1000),
+          static_cast<long>((ms % 1000) * 1000000L)};
+}
+
+// Monitor thread changes the sample points approximately every
+// `FLAG_sample_rate` milliseconds (or less often, if adaptive sampling has
+// backed off).
 static void Monitor(void) {
-  const timespec sample_time = {0, FLAG_sample_rate * 1000000L};
-  const timespec pause_time = {0, 1000000L};
+  auto sample_rate = static_cast<uint64_t>(FLAG_sample_rate);
   for (;;) {
-    for (auto timer = sample_time; ; ) {
+    for (auto timer = SampleTime(sample_rate); ; ) {
       if (!nanosleep(&timer, &timer)) break;
     }
-    while (!gSamplePointsLock.TryWriteAcquire()) {
-      nanosleep(&pause_time, nullptr);
+
+    const auto start_cycles = arch::CycleCount();
+    const auto old_set = gActiveSamplePointSet.load();
+    const auto new_set = (old_set + 1) % kNumSamplePointSets;
+
+    // Readers of `new_set` were already drained during the last period, so
+    // it's safe to populate it before publishing it.
+    auto num_samples = PopulateSamplePoints(new_set);
+    gActiveSamplePointSet.store(new_set);
+
+    const auto grace_start_cycles = arch::CycleCount();
+    WaitForReaders(old_set);
+    const auto grace_end_cycles = arch::CycleCount();
+
+    CoolTypes();
+    auto found_contention = LogSamplePoints(old_set);
+    ClearSamplePoints(old_set);
+    ActivateSamplePoints(new_set, num_samples);
+    ++gSamplingPeriod;
+
+    // Back off the sample rate while nothing is contended.
+    if (FLAG_adaptive_sampling) {
+      if (found_contention) {
+        sample_rate = FLAG_sample_rate;
+      } else {
+        sample_rate = GRANARY_MIN(sample_rate * 2,
+                                  FLAG_sample_rate * kMaxSampleRateBackoff);
+      }
+    }
+
+    if (FLAG_collect_memop_stats) {
+      auto grace_cycles = grace_end_cycles - grace_start_cycles;
+      gNumSamplesTaken.fetch_add(num_samples - 1, std::memory_order_relaxed);
+      gGracePeriodCycles.fetch_add(grace_cycles, std::memory_order_relaxed);
+      gMonitorCycles.fetch_add(
+          arch::CycleCount() - start_cycles - grace_cycles,
+          std::memory_order_relaxed);
     }
-    LogSamplePoints();
-    ClearActiveSamplePoints();
-    gSamplePointsLock.WriteRelease();
-    ActivateSamplePoints();
   }
 }
 
+// Log the costs of sampling.
+static void LogSamplingStats(void) {
+  os::Log("Malcontent sampling:\n  %lu sampling periods\n"
+          "  %lu samples taken\n  %lu contention checks\n"
+          "  %lu cycles spent changing sample points\n"
+          "  %lu cycles spent waiting for readers to drain\n\n",
+          gSamplingPeriod, gNumSamplesTaken.load(),
+          gNumContentionChecks.load(), gMonitorCycles.load(),
+          gGracePeriodCycles.load());
+}
+
 // Initialize the monitoring process for Malcontent. This allows us to set
 // hardware watchpoints.
 static void CreateMonitorThread(void) {
@@ -661,8 +872,9 @@ class Malcontent : public InstrumentationTool {
 
       InitTrainingFile();
       CreateMonitorThread();
-      AddShadowStructure<OwnershipTracker>(InstrumentMemOp,
-                                           ShouldInstrumentMemOp);
+      AddShadowStructure<OwnershipTracker>(
+          InstrumentMemOp, ShouldInstrumentMemOp, kShadowMemoryModeCompact,
+          kMemoryAccessHeap | kMemoryAccessGlobalData);
 
       tracker_reg[0] = AllocateVirtualRegister();
       tracker_reg[1] = AllocateVirtualRegister();
@@ -674,7 +886,10 @@ class Malcontent : public InstrumentationTool {
   // Exit; this kills off the monitor thread.
   static void Exit(ExitReason reason) {
     if (kExitProgram == reason || kExitDetach == reason) {
-      if (FLAG_collect_memop_stats) ForEachMetaData(LogMemOpStats);
+      if (FLAG_collect_memop_stats) {
+        ForEachMetaData(LogMemOpStats);
+        LogSamplingStats();
+      }
 
       // Heavy weight tear-down because we're detaching (but might
       // re-attach later).
@@ -684,7 +899,7 @@ class Malcontent : public InstrumentationTool {
         gCurrSourceIndex = 0;
         gPauseTime = 0;
         memset(gRecentAllocations, 0, sizeof gRecentAllocations);
-        ClearActiveSamplePoints();
+        ClearAllSamplePoints();
         ExitTrainingFile();
       }
     }
@@ -736,11 +951,18 @@ class Malcontent : public InstrumentationTool {
     // ownership. If we've reached here, then we're the contender.
     if (!tracker.sample_id) return;
 
-    ReadLockedRegion locker(&gSamplePointsLock);
+    if (FLAG_collect_memop_stats) {
+      gNumContentionChecks.fetch_add(1, std::memory_order_relaxed);
+    }
 
-    auto &sample_point(gSamplePoints[tracker.sample_id]);
+    SamplePointSetReader sample_points;
+    auto &sample_point(sample_points[tracker.sample_id]);
     if (!sample_point.type_id) return;
 
+    // The tracker was activated by a previous sample point set, and the same
+    // sample ID now refers to a different tracker.
+    if (sample_point.tracker != ShadowOf<OwnershipTracker>(address)) return;
+
     const int trace = !!tracker.thread_base;
 
     // We just took ownership; re-add the watchpoint.
@@ -770,9 +992,10 @@ class Malcontent : public InstrumentationTool {
 
   // Returns `true` if a particular memory operand should or should not be
   // instrumented.
+  //
+  // Note: Stack, read-only and thread-local accesses are filtered out by the
+  //       shadow memory tool before this is invoked.
   static bool ShouldInstrumentMemOp(const InstrumentedMemoryOperand &op) {
-    if (op.native_addr_op.IsStackPointerAlias()) return false;
-
     auto is_instrumented = true;
     auto offs = os::ModuleOffsetOfPC(op.block->StartAppPC());
     for (auto mod : TrainedModuleInfoIterator(gTrainedModules)) {
@@ -5,6 +5,13 @@
 
 GRANARY_USING_NAMESPACE granary;
 
+GRANARY_DEFINE_bool(frame_pointer_accesses_are_stack, false,
+    "Should memory accesses relative to the frame pointer (e.g. `RBP`) be "
+    "classified as stack accesses? This is only safe if the program is "
+    "compiled with frame pointers. The default is `no`.",
+
+    "memop");
+
 namespace {
 
 // Hooks that other tools can use for interposing on memory operands that will
@@ -12,6 +19,11 @@ namespace {
 static ClosureList<const InstrumentedMemoryOperand &>
     gMemOpHooks GRANARY_GLOBAL;
 
+// Hooks that other tools can use for instrumenting groups of memory operands
+// that share a base register.
+static ClosureList<const MemoryOperandGroup &>
+    gMemOpGroupHooks GRANARY_GLOBAL;
+
 }  // namespace
 
 // Abstract tool for instrumenting memory operands.
@@ -20,7 +32,11 @@ class MemOpTool : public InstrumentationTool {
   MemOpTool(void)
       : bb(nullptr),
         instr(nullptr),
-        op_num(0) {}
+        op_num(0),
+        is_grouped(false),
+        next_evicted_group(0) {
+    for (auto &group : groups) group.num_ops = 0;
+  }
 
   virtual ~MemOpTool(void) = default;
 
@@ -34,6 +50,7 @@ class MemOpTool : public InstrumentationTool {
   static void Exit(ExitReason reason) {
     if (kExitDetach == reason) {
       gMemOpHooks.Reset();
+      gMemOpGroupHooks.Reset();
     }
   }
 
@@ -52,13 +69,37 @@ class MemOpTool : public InstrumentationTool {
       } else if (1 == num_matched) {
         InstrumentMemOp(mloc1);
       }
+      if (!gMemOpGroupHooks.IsEmpty()) FlushClobberedGroups();
     }
+    for (auto &group : groups) FlushGroup(&group);
   }
 
  private:
+  enum {
+    // Maximum number of groups of memory operands that can be built up at
+    // once.
+    kMaxNumOpenGroups = 4,
+
+    // Maximum number of memory operands in a single group.
+    kMaxNumGroupedMemOps = 8
+  };
+
+  // A group of memory operands that is still being built up.
+  struct OpenMemOpGroup {
+    NativeInstruction *first_instr;
+    VirtualRegister base_reg;
+    intptr_t begin_displacement;
+    intptr_t end_displacement;
+    MemoryAccessKind access_kind;
+    size_t num_ops;
+    GroupedMemoryOperand ops[kMaxNumGroupedMemOps];
+  };
 
   // Dispatches to all hooks.
-  static void InstrumentMemOp(const InstrumentedMemoryOperand &op) {
+  void InstrumentMemOp(MemoryOperand &mloc,
+                       const RegisterOperand &addr_reg_op) {
+    InstrumentedMemoryOperand op = {bb, instr, mloc, addr_reg_op, op_num,
+                                    ClassifyMemOp(mloc), is_grouped};
     gMemOpHooks.ApplyAll(op);
   }
 
@@ -66,6 +107,8 @@ class MemOpTool : public InstrumentationTool {
   void InstrumentMemOp(MemoryOperand &mloc) {
     if (mloc.IsEffectiveAddress()) return;  // Doesn't access memory.
 
+    is_grouped = GroupMemOp(mloc);
+
     // Reads or writes from an absolute address, not through a register.
     VirtualRegister addr_reg, seg_reg;
     const void *addr_ptr(nullptr);
@@ -84,11 +127,119 @@ class MemOpTool : public InstrumentationTool {
     }
   }
 
+  // Returns true if `reg` is used as a base register for stack accesses.
+  //
+  // Note: Early mangling replaces frame pointer-relative memory operands, e.g.
+  //       `[RBP - 8]`, with dereferences of virtual registers that are marked
+  //       as frame pointer aliases.
+  static bool IsStackBase(VirtualRegister reg) {
+    if (reg.IsStackPointerAlias() || reg.IsStackPointer()) return true;
+    return FLAG_frame_pointer_accesses_are_stack &&
+           (reg.IsFramePointerAlias() ||
+            (reg.IsNative() && VirtualRegister::FramePointer() == reg));
+  }
+
+  // Returns true if `addr` is mapped as read-only by some module.
+  static bool IsReadOnlyData(const void *addr) {
+    for (auto module : os::LoadedModules()) {
+      if (module->ContainsReadOnly(addr)) return true;
+    }
+    return false;
+  }
+
+  // Try to add `mloc` to a group of memory operands that share the same base
+  // register. Returns `true` if `mloc` was grouped.
+  bool GroupMemOp(const MemoryOperand &mloc) {
+    if (gMemOpGroupHooks.IsEmpty()) return false;
+
+    VirtualRegister base_reg;
+    intptr_t disp(0);
+    if (!instr->MatchBaseAndDisplacement(mloc, base_reg, disp)) return false;
+    if (!base_reg.IsNative() || !base_reg.IsGeneralPurpose()) return false;
+
+    auto group = FindGroup(base_reg);
+    if (kMaxNumGroupedMemOps == group->num_ops) FlushGroup(group);
+
+    auto num_bytes = mloc.ByteWidth();
+    auto end_disp = disp + static_cast<intptr_t>(num_bytes);
+    if (!group->num_ops) {
+      group->first_instr = instr;
+      group->base_reg = base_reg;
+      group->begin_displacement = disp;
+      group->end_displacement = end_disp;
+      group->access_kind = ClassifyMemOp(mloc);
+    } else {
+      group->begin_displacement = GRANARY_MIN(group->begin_displacement, disp);
+      group->end_displacement = GRANARY_MAX(group->end_displacement, end_disp);
+    }
+    group->ops[group->num_ops++] = {instr, disp, num_bytes, op_num};
+    return true;
+  }
+
+  // Find the open group for `base_reg`, or start a new group. If too many
+  // groups are open then one of them is flushed to make room.
+  OpenMemOpGroup *FindGroup(VirtualRegister base_reg) {
+    OpenMemOpGroup *free_group(nullptr);
+    for (auto &group : groups) {
+      if (!group.num_ops) {
+        if (!free_group) free_group = &group;
+      } else if (group.base_reg == base_reg) {
+        return &group;
+      }
+    }
+    if (!free_group) {
+      free_group = &(groups[next_evicted_group++ % kMaxNumOpenGroups]);
+      FlushGroup(free_group);
+    }
+    return free_group;
+  }
+
+  // Flush any groups whose base register is written by the current
+  // instruction. Later accesses through the same register will start a new
+  // group.
+  void FlushClobberedGroups(void) {
+    WrittenRegisterSet written_regs;
+    written_regs.Visit(instr);
+    for (auto &group : groups) {
+      if (group.num_ops && written_regs.IsLive(group.base_reg)) {
+        FlushGroup(&group);
+      }
+    }
+  }
+
+  // Dispatches a group of memory operands to all group hooks.
+  void FlushGroup(OpenMemOpGroup *group) {
+    if (!group->num_ops) return;
+    RegisterOperand base_reg_op(group->base_reg);
+    MemoryOperandGroup op_group = {
+      bb, group->first_instr, base_reg_op, group->begin_displacement,
+      group->end_displacement, group->access_kind, &(group->ops[0]),
+      group->num_ops
+    };
+    gMemOpGroupHooks.ApplyAll(op_group);
+    group->num_ops = 0;
+  }
+
+  // Statically classify the kind of memory accessed by `mloc`.
+  static MemoryAccessKind ClassifyMemOp(const MemoryOperand &mloc) {
+    VirtualRegister seg_reg, base_reg, index_reg;
+    const void *addr_ptr(nullptr);
+    if (mloc.MatchSegmentRegister(seg_reg)) {
+      return kMemoryAccessThreadLocal;
+    } else if (mloc.MatchPointer(addr_ptr)) {
+      return IsReadOnlyData(addr_ptr) ? kMemoryAccessReadOnlyData
+                                      : kMemoryAccessGlobalData;
+    } else if (mloc.CountMatchedRegisters(base_reg, index_reg) &&
+               IsStackBase(base_reg)) {
+      return kMemoryAccessStack;
+    }
+    return kMemoryAccessHeap;
+  }
+
   // Instrument a memory operand that accesses some memory through a register.
   void InstrumentRegMemOp(MemoryOperand &mloc, VirtualRegister reg) {
     RegisterOperand addr_reg_op(reg);
-    InstrumentedMemoryOperand op = {bb, instr, mloc, addr_reg_op, op_num};
-    InstrumentMemOp(op);
+    InstrumentMemOp(mloc, addr_reg_op);
   }
 
   // Instrument a memory operand that accesses some memory through an offset of
@@ -102,8 +253,7 @@ class MemOpTool : public InstrumentationTool {
     lir::InlineAssembly asm_(offset_op, addr_reg_op, seg_reg_op);
     asm_.InlineBefore(instr, "MOV r64 %1, m64 %2:[0];"
                              "LEA r64 %1, m64 [%1 + %0];"_x86_64);
-    InstrumentedMemoryOperand op = {bb, instr, mloc, addr_reg_op, op_num};
-    InstrumentMemOp(op);
+    InstrumentMemOp(mloc, addr_reg_op);
   }
 
   // Instrument a memory operand that accesses some absolute memory address.
@@ -112,8 +262,7 @@ class MemOpTool : public InstrumentationTool {
     RegisterOperand addr_reg_op(virt_addr_reg[op_num]);
     lir::InlineAssembly asm_(native_addr, addr_reg_op);
     asm_.InlineBefore(instr, "MOV r64 %1, i64 %0;"_x86_64);
-    InstrumentedMemoryOperand op = {bb, instr, mloc, addr_reg_op, op_num};
-    InstrumentMemOp(op);
+    InstrumentMemOp(mloc, addr_reg_op);
   }
 
   // Instrument a compound memory operation.
@@ -121,16 +270,16 @@ class MemOpTool : public InstrumentationTool {
     auto addr_reg = virt_addr_reg[op_num];
 
     // Track stack pointer propagation.
-    VirtualRegister base;
-    if (mloc.CountMatchedRegisters(base) && base.IsStackPointerAlias()) {
+    VirtualRegister base, index;
+    if (mloc.CountMatchedRegisters(base, index) &&
+        base.IsStackPointerAlias()) {
       addr_reg.MarkAsStackPointerAlias();
     }
 
     RegisterOperand addr_reg_op(addr_reg);
     lir::InlineAssembly asm_(mloc, addr_reg_op);
     asm_.InlineBefore(instr, "LEA r64 %1, m64 %0;"_x86_64);
-    InstrumentedMemoryOperand op = {bb, instr, mloc, addr_reg_op, op_num};
-    InstrumentMemOp(op);
+    InstrumentMemOp(mloc, addr_reg_op);
   }
 
   // Current block being instrumented.
@@ -142,6 +291,13 @@ class MemOpTool : public InstrumentationTool {
   // Current memory operand being instrumented.
   size_t op_num;
 
+  // Is the current memory operand part of a group?
+  bool is_grouped;
+
+  // Groups of memory operands that are being built up for the current block.
+  OpenMemOpGroup groups[kMaxNumOpenGroups];
+  size_t next_evicted_group;
+
   // Virtual registers used throughout.
   static VirtualRegister virt_addr_reg[2];
 };
@@ -153,6 +309,12 @@ void AddMemOpInstrumenter(void (*func)(const InstrumentedMemoryOperand &)) {
   gMemOpHooks.Add(func);
 }
 
+// Registers a function that is invoked once per group of memory operands in
+// a block.
+void AddMemOpGroupInstrumenter(void (*func)(const MemoryOperandGroup &)) {
+  gMemOpGroupHooks.Add(func);
+}
+
 GRANARY_ON_CLIENT_INIT() {
   AddInstrumentationTool<MemOpTool>("memop");
 }
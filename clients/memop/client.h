@@ -5,6 +5,33 @@
 
 #include <granary.h>
 
+// Static classification of the memory accessed by an instrumented memory
+// operand. The kinds are bit flags so that they can be combined into masks of
+// "interesting" accesses.
+enum MemoryAccessKind : unsigned {
+  // Accesses memory through a register that is not known to alias the stack.
+  // This is most likely heap memory.
+  kMemoryAccessHeap = (1U << 0),
+
+  // Accesses memory relative to the stack pointer, or relative to a register
+  // that aliases the stack pointer.
+  kMemoryAccessStack = (1U << 1),
+
+  // Accesses an absolute (e.g. `RIP`-relative) address that is mapped as
+  // read-only by some module (e.g. `.rodata`).
+  kMemoryAccessReadOnlyData = (1U << 2),
+
+  // Accesses an absolute (e.g. `RIP`-relative) address that is not known to
+  // be read-only.
+  kMemoryAccessGlobalData = (1U << 3),
+
+  // Accesses memory relative to a segment register (e.g. `%fs`-relative
+  // thread-local storage).
+  kMemoryAccessThreadLocal = (1U << 4),
+
+  kMemoryAccessAny = (1U << 5) - 1U
+};
+
 // Represents an "instrumented" memory operand in a general way.
 class InstrumentedMemoryOperand {
  public:
@@ -25,11 +52,82 @@ class InstrumentedMemoryOperand {
   // going to be `0` or `1`.
   const size_t operand_number;
 
+  // What kind of memory does `native_mem_op` access?
+  const MemoryAccessKind access_kind;
+
+  // Is this memory operand also reported as part of a `MemoryOperandGroup`?
+  // Tools that instrument whole groups can skip grouped operands.
+  const bool is_grouped;
+
+  // Returns true if this operand accesses one of the kinds of memory in the
+  // mask `kinds`.
+  inline bool AccessesAny(unsigned kinds) const {
+    return 0 != (access_kind & kinds);
+  }
+
  private:
   GRANARY_DISALLOW_COPY_AND_ASSIGN(InstrumentedMemoryOperand);
 };
 
+// Represents one memory operand within a `MemoryOperandGroup`.
+class GroupedMemoryOperand {
+ public:
+  // Instruction that contains the memory operand.
+  granary::NativeInstruction *instr;
+
+  // Displacement of the accessed memory from the group's base register.
+  intptr_t displacement;
+
+  // Number of bytes accessed by the memory operand.
+  size_t num_bytes;
+
+  // Which memory operand (of the instruction) is this? This is going to be
+  // `0` or `1`.
+  size_t operand_number;
+};
+
+// Represents a group of memory operands in a block that all access memory at
+// a constant displacement from the same base register, and where the base
+// register is not redefined between the first and last accesses of the group.
+//
+// For example, the 8-byte accesses `[RBX]`, `[RBX + 8]` and `[RBX + 16]` form
+// one group whose accessed range is `[RBX, RBX + 24)`.
+class MemoryOperandGroup {
+ public:
+  // Block that contains all memory operands of the group.
+  granary::DecodedBlock * const block;
+
+  // Instruction that contains the first memory operand of the group. Code
+  // that instruments the group as a whole should go before this instruction,
+  // where `base_reg_op` holds the same value as at every access of the group.
+  granary::NativeInstruction * const first_instr;
+
+  // Register operand containing the base address of the group.
+  const granary::RegisterOperand &base_reg_op;
+
+  // The range of memory accessed by the group is
+  // `[base + begin_displacement, base + end_displacement)`.
+  const intptr_t begin_displacement;
+  const intptr_t end_displacement;
+
+  // What kind of memory do the operands of this group access?
+  const MemoryAccessKind access_kind;
+
+  // The memory operands of this group, in program order.
+  const GroupedMemoryOperand * const ops;
+  const size_t num_ops;
+
+ private:
+  GRANARY_DISALLOW_COPY_AND_ASSIGN(MemoryOperandGroup);
+};
+
 // Registers a function that can hook into the memory operands instrumenter.
 void AddMemOpInstrumenter(void (*func)(const InstrumentedMemoryOperand &));
 
+// Registers a function that is invoked once per group of memory operands in
+// a block. Only memory operands of the form `[base + displacement]` are
+// grouped; all memory operands are still passed to the functions registered
+// with `AddMemOpInstrumenter`.
+void AddMemOpGroupInstrumenter(void (*func)(const MemoryOperandGroup &));
+
 #endif  // CLIENTS_MEMOP_CLIENT_H_
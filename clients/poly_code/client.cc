@@ -208,12 +208,12 @@ class PolyCode : public InstrumentationTool {
     auto meta = GetMetaData<TypeMetaData>(op.block);
     if (!meta) return;
     if (FLAG_record_block_types) {
-      op.instr->InsertBefore(lir::InlineFunctionCall(op.block,
+      op.instrument_instr->InsertBefore(lir::InlineFunctionCall(op.block,
           TaintBlock, meta, op.watched_reg_op));
     } else {
       MemoryOperand is_typed(&(meta->accesses_typed_data));
       lir::InlineAssembly asm_(is_typed);
-      asm_.InlineBefore(op.instr, "OR m8 %0, i8 1;");
+      asm_.InlineBefore(op.instrument_instr, "OR m8 %0, i8 1;");
     }
   }
 
@@ -24,36 +24,93 @@ enum : uint64_t {
   //            the buffer cache is heavily used).
   kUnscaledShadowMemSize = 1ULL << 32UL,
 
+  // Number of significant bits in a canonical user space address.
+  kNumUserAddressBits = 47,
+
+  // Upper bound on the size of shadow memory in `kShadowMemoryModeFull`. This
+  // leaves at least half of the user address space to the program.
+  kMaxFullShadowMemSize = 1ULL << (kNumUserAddressBits - 1),
+
   // Arbitrary maximum.
   kMaxNumShadowStructures = 16
 };
 
 typedef LinkedListIterator<ShadowStructureDescription> ShadowStructureIterator;
 
+// A region of shadow memory. Each `ShadowMemoryMode` has its own region, and
+// each region has its own shadow unit, containing all shadow structures with
+// that mode.
+struct ShadowRegion {
+  size_t unaligned_size;
+  size_t aligned_size;
+  size_t scale_amount_long;
+  uint8_t scale_amount;
+  size_t prev_offset;
+
+  // Total size of the shadow memory of this region.
+  size_t mem_num_pages;
+  size_t mem_size;
+
+  // Pointer to the shadow memory of this region.
+  char *mem;
+};
+
 // Descriptions of the meta-data structures.
 static ShadowStructureDescription *gDescriptions = nullptr;
 static ShadowStructureDescription **gNextDescription = &gDescriptions;
 static size_t gNumDescriptions = 0;
 
-static size_t gUnalignedSize = 0;
-static size_t gAlignedSize = 1;
-static size_t gScaleAmountLong = 0;
-static uint8_t gScaleAmount = 0;
-static size_t gPrevOffset = 0;
+// Shadow memory regions, indexed by `ShadowMemoryMode`.
+static ShadowRegion gRegions[kNumShadowMemoryModes] = {
+  {0, 1, 0, 0, 0, 0, 0, nullptr},
+  {0, 1, 0, 0, 0, 0, 0, nullptr}
+};
 
 // Defines the granularity of shadow memory in terms of a shift.
 static size_t gShiftAmountLong = 0;
 static uint8_t gShiftAmount = 0;
 
-// Total size of shadow memory.
-static size_t gShadowMemNumPages = 0;
-static size_t gShadowMemSize = 0;
+// In `kShadowMemoryModeFull`, addresses are first shifted left to remove any
+// non-canonical bits, then shifted right by this amount.
+static size_t gFullShiftAmountLong = 0;
+static uint8_t gFullShiftAmount = 0;
 
-// Pointer to shadow memory.
-static char *gShadowMem = nullptr;
+// Has shadow memory been allocated?
+static bool gShadowMemIsInitialized = false;
 GRANARY_IF_USER( static int gShadowFd = -1; )
 static SpinLock gShadowMemLock GRANARY_GLOBAL;
 
+// Returns the number of shadow units in the shadow memory of some mode.
+static size_t NumShadowUnits(ShadowMemoryMode mode) {
+  if (kShadowMemoryModeFull == mode) {
+    return 1ULL << (kNumUserAddressBits - gShiftAmountLong);
+  } else {
+    return kUnscaledShadowMemSize;
+  }
+}
+
+// Returns the size of the shadow memory of some mode, if its shadow unit were
+// `unaligned_size` bytes.
+static size_t ShadowMemSize(ShadowMemoryMode mode, size_t unaligned_size) {
+  auto aligned_size = 1UL;
+  while (aligned_size < unaligned_size) aligned_size <<= 1;
+  return GRANARY_ALIGN_TO(NumShadowUnits(mode) * aligned_size,
+                          arch::PAGE_SIZE_BYTES);
+}
+
+#ifdef GRANARY_WHERE_user
+// Map `size` bytes of shadow memory, or die trying.
+static char *MapShadowMemory(size_t size, int flags, int fd) {
+  auto mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_NORESERVE | flags, fd, 0);
+  if (MAP_FAILED == mem) {
+    os::Log("ERROR: Couldn't map %lu bytes of shadow memory.\n", size);
+    exit(EXIT_FAILURE);
+  }
+  return reinterpret_cast<char *>(mem);
+}
+#endif  // GRANARY_WHERE_user
+
 }  // namespace
 
 // Simple tool for direct-mapped shadow memory.
@@ -73,6 +130,9 @@ class ShadowMemory : public InstrumentationTool {
       gShiftAmount = static_cast<uint8_t>(gShiftAmountLong);
       GRANARY_ASSERT(0 != gShiftAmount);
 
+      gFullShiftAmountLong = 64 - kNumUserAddressBits + gShiftAmountLong;
+      gFullShiftAmount = static_cast<uint8_t>(gFullShiftAmountLong);
+
       AddMemOpInstrumenter(InstrumentMemOp);
 
       shadow_addr_reg[0] = AllocateVirtualRegister();
@@ -89,31 +149,30 @@ class ShadowMemory : public InstrumentationTool {
         gDescriptions = desc->next;
         desc->next = nullptr;
         desc->instrumenter = nullptr;
+        desc->mode = kShadowMemoryModeCompact;
         desc->is_registered = false;
         desc->offset_asm_instruction[0] = '\0';
       }
 
       gNextDescription = &gDescriptions;
       gNumDescriptions = 0;
-      gUnalignedSize = 0;
-      gAlignedSize = 1;
-      gPrevOffset = 0;
-      gScaleAmountLong = 0;
-      gScaleAmount = 0;
       gShiftAmountLong = 0;
       gShiftAmount = 0;
+      gFullShiftAmountLong = 0;
+      gFullShiftAmount = 0;
       ExitShadowMemory();
-      gShadowMemSize = 0;
-      gShadowMemNumPages = 0;
-      gShadowMem = nullptr;
+      for (auto &region : gRegions) {
+        memset(&region, 0, sizeof region);
+        region.aligned_size = 1;
+      }
+      gShadowMemIsInitialized = false;
       GRANARY_IF_USER( gShadowFd = -1; )
     }
   }
 
   virtual void InstrumentBlocks(Trace *) override {
-    if (GRANARY_UNLIKELY(!gShadowMemSize)) return;
     if (GRANARY_UNLIKELY(!gDescriptions)) return;
-    if (GRANARY_UNLIKELY(!gShadowMem)) InitShadowMemory();
+    if (GRANARY_UNLIKELY(!gShadowMemIsInitialized)) InitShadowMemory();
   }
 
  private:
@@ -121,18 +180,31 @@ class ShadowMemory : public InstrumentationTool {
 
     // Should we instrument this memory operand?
     auto i = 0;
-    auto do_instrument = false;
     bool instrument[kMaxNumShadowStructures] = {false};
+    bool instrument_mode[kNumShadowMemoryModes] = {false};
     for (auto desc : ShadowStructureIterator(gDescriptions)) {
-      if ((instrument[i++] = desc->predicate(op))) {
-        do_instrument = true;
+      if ((instrument[i++] = op.AccessesAny(desc->access_kinds) &&
+                             desc->predicate(op))) {
+        instrument_mode[desc->mode] = true;
+      }
+    }
+
+    // Compute the shadow address for each region that has a structure
+    // interested in this memory operand.
+    for (auto mode = 0; mode < kNumShadowMemoryModes; ++mode) {
+      if (instrument_mode[mode]) {
+        InstrumentMemOp(op, static_cast<ShadowMemoryMode>(mode), instrument);
       }
     }
-    if (!do_instrument) return;  // No, we shouldn't.
+  }
 
-    ImmediateOperand shift(gShiftAmount);
-    ImmediateOperand scale(gScaleAmount);
-    MemoryOperand shadow_base(gShadowMem);
+  static void InstrumentMemOp(const InstrumentedMemoryOperand &op,
+                              ShadowMemoryMode mode, const bool *instrument) {
+    const auto &region(gRegions[mode]);
+    const auto is_full = kShadowMemoryModeFull == mode;
+    ImmediateOperand shift(is_full ? gFullShiftAmount : gShiftAmount);
+    ImmediateOperand scale(region.scale_amount);
+    MemoryOperand shadow_base(region.mem);
     RegisterOperand shadow_addr(shadow_addr_reg[op.operand_number]);
     RegisterOperand shadow_base_addr(shadow_base_reg);
     lir::InlineAssembly asm_(shift, scale, shadow_base, op.native_addr_op,
@@ -143,31 +215,42 @@ class ShadowMemory : public InstrumentationTool {
 
     // %0 is an i8 shift amount.
     // %1 is an i8 scale amount.
-    // %2 is an i64 containing the value of `gShadowMem`.
+    // %2 is an i64 containing the address of this region's shadow memory.
     // %3 is an r64 native pointer.
     // %4 will be our shadow pointer (calculated based on %3).
     // %5 is our shadow base
 
-    // Scale the native address by the granularity of the shadow memory.
-    asm_.InlineBeforeIf(op.instr, 0 < gShiftAmount,
-        "SHR r64 %4, i8 %0;"_x86_64);
+    if (is_full) {
+      // Chop off the non-canonical high-order bits (64 - 47 = 17) of the
+      // native address, then scale the address by the granularity of the
+      // shadow memory.
+      asm_.InlineBefore(op.instr,
+          "SHL r64 %4, i8 17;"
+          "SHR r64 %4, i8 %0;"_x86_64);
+    } else {
+      // Scale the native address by the granularity of the shadow memory.
+      asm_.InlineBeforeIf(op.instr, 0 < gShiftAmount,
+          "SHR r64 %4, i8 %0;"_x86_64);
+
+      // Chop off the high-order 32 bits of the shadow offset. This has the
+      // benefit of making it more likely that both shadow memory and address
+      // watchpoints can be simultaneously used.
+      asm_.InlineBefore(op.instr,
+          "MOV r32 %4, r32 %4;"_x86_64);
+    }
 
-    // Chop off the high-order 32 bits of the shadow offset, then scale the
-    // offset by the size of the shadow structure. This has the benefit of
-    // making it more likely that both shadow memory and address watchpoints
-    // can be simultaneously used.
-    asm_.InlineBefore(op.instr,
-        "MOV r32 %4, r32 %4;"_x86_64);
-    asm_.InlineBeforeIf(op.instr, 1 < gAlignedSize,
+    // Scale the offset by the size of the shadow unit, then add the shadow
+    // base to the offset, forming the shadow pointer.
+    asm_.InlineBeforeIf(op.instr, 1 < region.aligned_size,
         "SHL r64 %4, i8 %1;"_x86_64);
-
-    // Add the shadow base to the offset, forming the shadow pointer.
     asm_.InlineBefore(op.instr,
         "ADD r64 %4, r64 %5;"_x86_64);
     auto native_addr_op(asm_.Register(op.block, 3));
     auto shadow_addr_op(asm_.Register(op.block, 4));
-    i = 0;
+    auto i = 0;
     for (auto desc : ShadowStructureIterator(gDescriptions)) {
+      auto should_instrument = instrument[i++];
+      if (desc->mode != mode) continue;
 
       // Move `%4` (the offset/pointer) to point to this description's
       // structure.
@@ -175,7 +258,7 @@ class ShadowMemory : public InstrumentationTool {
 
       // Some shadow tools might want to instrument this memop while others
       // might not.
-      if (instrument[i++]) {
+      if (should_instrument) {
         ShadowedMemoryOperand shadow_op{op.block, op.instr, op.native_mem_op,
                                         shadow_addr_op, native_addr_op,
                                         op.operand_number};
@@ -188,33 +271,49 @@ class ShadowMemory : public InstrumentationTool {
   // Initialize the shadow memory if it has not yet been initialized.
   static void InitShadowMemory(void) {
     SpinLockedRegion locker(&gShadowMemLock);
-    if (gShadowMem) return;  // Double-checked locking ;-)
+    if (gShadowMemIsInitialized) return;  // Double-checked locking ;-)
 
     // Note: We don't use `os::AllocateDataPages` in user space because
     //       we want these page to be lazily mapped. We use `/dev/zero` in
     //       `O_RDONLY` so that all zero pages only use a single physical page.
-    gShadowFd = open("/dev/zero", O_RDONLY);
-    gShadowMem = reinterpret_cast<char *>(mmap(
-        nullptr, gShadowMemSize, PROT_READ | PROT_WRITE,
-        MAP_PRIVATE | MAP_NORESERVE, gShadowFd, 0));
+    auto &compact(gRegions[kShadowMemoryModeCompact]);
+    if (compact.mem_size) {
+      gShadowFd = open("/dev/zero", O_RDONLY);
+      compact.mem = MapShadowMemory(compact.mem_size, 0, gShadowFd);
+    }
+
+    // The full region is only reserved; the OS populates shadow pages on
+    // demand as they are first touched.
+    auto &full(gRegions[kShadowMemoryModeFull]);
+    if (full.mem_size) {
+      full.mem = MapShadowMemory(full.mem_size, MAP_ANONYMOUS, -1);
+    }
+    gShadowMemIsInitialized = true;
   }
 
   static void ExitShadowMemory(void) {
-    if (gShadowMem) {
-      munmap(gShadowMem, gShadowMemSize);
-      close(gShadowFd);
+    for (auto &region : gRegions) {
+      if (region.mem) munmap(region.mem, region.mem_size);
     }
+    if (-1 != gShadowFd) close(gShadowFd);
   }
 #else
-// Initialize the shadow memory if it has not yet been initialized.
+  // Initialize the shadow memory if it has not yet been initialized.
   static void InitShadowMemory(void) {
     SpinLockedRegion locker(&gShadowMemLock);
-    if (gShadowMem) return;  // Double-checked locking ;-)
-    gShadowMem = os::AllocateDataPages(gShadowMemNumPages);
+    if (gShadowMemIsInitialized) return;  // Double-checked locking ;-)
+    for (auto &region : gRegions) {
+      if (!region.mem_num_pages) continue;
+      region.mem = reinterpret_cast<char *>(
+          os::AllocateDataPages(region.mem_num_pages));
+    }
+    gShadowMemIsInitialized = true;
   }
 
   static void ExitShadowMemory(void) {
-    if (gShadowMem) os::FreeDataPages(gShadowMemNumPages)
+    for (auto &region : gRegions) {
+      if (region.mem) os::FreeDataPages(region.mem, region.mem_num_pages);
+    }
   }
 #endif  // GRANARY_WHERE_user
 
@@ -226,17 +325,46 @@ VirtualRegister ShadowMemory::shadow_addr_reg[2];
 VirtualRegister ShadowMemory::shadow_base_reg;
 
 // Tells the shadow memory tool about a structure to be stored in shadow
-// memory.
+// memory. Structures with different modes are stored in separate regions of
+// shadow memory. Only memory operands whose `access_kind` is in the
+// `access_kinds` mask are considered.
 void AddShadowStructure(ShadowStructureDescription *desc,
                         void (*instrumenter)(const ShadowedMemoryOperand &),
-                        bool (*predicate)(const InstrumentedMemoryOperand &)) {
-  GRANARY_ASSERT(!gShadowMem);
+                        bool (*predicate)(const InstrumentedMemoryOperand &),
+                        ShadowMemoryMode mode, unsigned access_kinds) {
+  GRANARY_ASSERT(!gShadowMemIsInitialized);
   GRANARY_ASSERT(!desc->next);
   GRANARY_ASSERT(!desc->instrumenter);
   GRANARY_ASSERT(kMaxNumShadowStructures > gNumDescriptions);
 
+#ifdef GRANARY_WHERE_kernel
+  // The kernel's address space is too big to shadow in its entirety.
+  mode = kShadowMemoryModeCompact;
+#else
+  // Full shadow memory can't be bigger than `kMaxFullShadowMemSize`. Rather
+  // than silently falling back to compact shadow memory, which aliases the
+  // shadow structures of distinct addresses, refuse to run.
+  if (kShadowMemoryModeFull == mode) {
+    const auto &full(gRegions[kShadowMemoryModeFull]);
+    auto unaligned_size = full.unaligned_size +
+                          GRANARY_ALIGN_FACTOR(full.unaligned_size,
+                                               desc->align) + desc->size;
+    auto mem_size = ShadowMemSize(mode, unaligned_size);
+    if (kMaxFullShadowMemSize < mem_size) {
+      os::Log("ERROR: Full shadow memory would need %lu bytes, but at most "
+              "%lu bytes can be reserved. Try a larger "
+              "`--shadow_granularity` than %u.\n", mem_size,
+              static_cast<size_t>(kMaxFullShadowMemSize),
+              FLAG_shadow_granularity);
+      exit(EXIT_FAILURE);
+    }
+  }
+#endif  // GRANARY_WHERE_kernel
+
   desc->instrumenter = instrumenter;
   desc->predicate = predicate;
+  desc->mode = mode;
+  desc->access_kinds = access_kinds;
   desc->is_registered = true;
 
   *gNextDescription = desc;
@@ -245,49 +373,57 @@ void AddShadowStructure(ShadowStructureDescription *desc,
 
   // Update the descriptions to more accurately represent the shadow unit
   // size.
-  gUnalignedSize += GRANARY_ALIGN_FACTOR(gUnalignedSize, desc->align);
-  desc->offset = gUnalignedSize;
-  gUnalignedSize += desc->size;
+  auto &region(gRegions[mode]);
+  region.unaligned_size += GRANARY_ALIGN_FACTOR(region.unaligned_size,
+                                                desc->align);
+  desc->offset = region.unaligned_size;
+  region.unaligned_size += desc->size;
 
   // Figure out the offset of this structure from the previous shadow structure
   // and create an inline assembly instruction that we can inject to perform
   // this offsetting in order to get an address to this descriptor's shadow
   // structure.
   desc->offset_asm_instruction[0] = '\0';
-  if (auto offset_diff = (desc->offset - gPrevOffset)) {
+  if (auto offset_diff = (desc->offset - region.prev_offset)) {
     Format(desc->offset_asm_instruction, "ADD r64 %%4, i8 %lu;", offset_diff);
   }
-  gPrevOffset = desc->offset;
+  region.prev_offset = desc->offset;
 
   // How much (log2) do we need to scale a shifted address by in order to
   // address some shadow memory?
-  gScaleAmountLong = static_cast<size_t>(
-      32 - __builtin_clz(static_cast<uint32_t>(gUnalignedSize)) - 1);
+  region.scale_amount_long = static_cast<size_t>(
+      32 - __builtin_clz(static_cast<uint32_t>(region.unaligned_size)) - 1);
 
   // Adjust the aligned size of the shadow unit based on our newly added
   // description.
-  gAlignedSize = 1UL << gScaleAmountLong;
-  if (gUnalignedSize > gAlignedSize) {
-    gScaleAmountLong -= 1;
-    gAlignedSize = 1UL << gScaleAmountLong;
-    GRANARY_ASSERT(gAlignedSize >= gUnalignedSize);
+  region.aligned_size = 1UL << region.scale_amount_long;
+  if (region.unaligned_size > region.aligned_size) {
+    region.scale_amount_long += 1;
+    region.aligned_size = 1UL << region.scale_amount_long;
+    GRANARY_ASSERT(region.aligned_size >= region.unaligned_size);
   }
-  gScaleAmount = static_cast<uint8_t>(gScaleAmountLong);
+  region.scale_amount = static_cast<uint8_t>(region.scale_amount_long);
 
   // Scale the size of shadow memory based on the new shadow unit size.
-  gShadowMemSize = kUnscaledShadowMemSize * gAlignedSize;
-  gShadowMemSize = GRANARY_ALIGN_TO(gShadowMemSize, arch::PAGE_SIZE_BYTES);
-  gShadowMemNumPages = gShadowMemSize / arch::PAGE_SIZE_BYTES;
+  region.mem_size = NumShadowUnits(mode) * region.aligned_size;
+  region.mem_size = GRANARY_ALIGN_TO(region.mem_size, arch::PAGE_SIZE_BYTES);
+  region.mem_num_pages = region.mem_size / arch::PAGE_SIZE_BYTES;
 }
 
 // Returns the address of some shadow object.
 uintptr_t ShadowOf(const ShadowStructureDescription *desc, uintptr_t addr) {
+  const auto &region(gRegions[desc->mode]);
   GRANARY_ASSERT(desc->is_registered);
-  GRANARY_ASSERT(nullptr != gShadowMem);
-  addr >>= gShiftAmountLong;
-  addr <<= gScaleAmountLong;
-  addr &= 0xFFFFFFFFUL;
-  return reinterpret_cast<uintptr_t>(gShadowMem) + addr + desc->offset;
+  GRANARY_ASSERT(nullptr != region.mem);
+  if (kShadowMemoryModeFull == desc->mode) {
+    addr <<= 64 - kNumUserAddressBits;
+    addr >>= gFullShiftAmountLong;
+  } else {
+    addr >>= gShiftAmountLong;
+    addr &= 0xFFFFFFFFUL;
+  }
+  addr <<= region.scale_amount_long;
+  return reinterpret_cast<uintptr_t>(region.mem) + addr + desc->offset;
 }
 
 namespace detail {
@@ -32,6 +32,21 @@ class ShadowedMemoryOperand {
   GRANARY_DISALLOW_COPY_AND_ASSIGN(ShadowedMemoryOperand);
 };
 
+// How native addresses are mapped to shadow memory.
+enum ShadowMemoryMode {
+  // The scaled native address is truncated to 32 bits. This keeps shadow
+  // memory small, but native addresses that differ only in their high-order
+  // bits share the same shadow structure.
+  kShadowMemoryModeCompact,
+
+  // Every canonical user space address (47 bits) maps to its own shadow
+  // structure. Shadow memory is reserved up-front and populated on demand by
+  // the OS as shadow pages are touched.
+  kShadowMemoryModeFull,
+
+  kNumShadowMemoryModes
+};
+
 // Represents a description of a shadow memory structure.
 class ShadowStructureDescription {
  public:
@@ -42,6 +57,14 @@ class ShadowStructureDescription {
   const size_t size;
   const size_t align;
 
+  // How native addresses are mapped to this structure in shadow memory.
+  ShadowMemoryMode mode;
+
+  // Mask of `MemoryAccessKind`s that this structure is interested in. Memory
+  // operands that access other kinds of memory are never passed to
+  // `predicate`.
+  unsigned access_kinds;
+
   // Have we registered this shadow data structure?
   bool is_registered;
 
@@ -76,15 +99,22 @@ ShadowStructureDescription GetShadowStructureDescription<T>::kDescription = {
   0,
   sizeof(T),
   alignof(T),
+  kShadowMemoryModeCompact,
+  kMemoryAccessAny,
   false,
   {'\0'}
 };
 
 // Tells the shadow memory tool about a structure to be stored in shadow
-// memory.
+// memory. Structures with different modes are stored in separate regions of
+// shadow memory. Only memory operands whose `access_kind` is in the
+// `access_kinds` mask are considered (e.g. `kMemoryAccessHeap` for "heap
+// only" structures).
 void AddShadowStructure(ShadowStructureDescription *desc,
                         void (*instrumenter)(const ShadowedMemoryOperand &),
-                        bool (*predicate)(const InstrumentedMemoryOperand &));
+                        bool (*predicate)(const InstrumentedMemoryOperand &),
+                        ShadowMemoryMode mode=kShadowMemoryModeCompact,
+                        unsigned access_kinds=kMemoryAccessAny);
 
 // Returns the address of the shadow memory descriptor.
 template <typename T>
@@ -96,8 +126,11 @@ template <typename T>
 inline static void AddShadowStructure(
     void (*instrumenter)(const ShadowedMemoryOperand &),
     bool (*predicate)(const InstrumentedMemoryOperand &)=\
-        detail::AlwaysInstrumentMemOpPredicate) {
-  AddShadowStructure(ShadowDescription<T>(), instrumenter, predicate);
+        detail::AlwaysInstrumentMemOpPredicate,
+    ShadowMemoryMode mode=kShadowMemoryModeCompact,
+    unsigned access_kinds=kMemoryAccessAny) {
+  AddShadowStructure(ShadowDescription<T>(), instrumenter, predicate, mode,
+                     access_kinds);
 }
 
 // Returns the address of some shadow object.
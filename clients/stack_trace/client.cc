@@ -1,5 +1,7 @@
 /* Copyright 2014 Peter Goodman, all rights reserved. */
 
+#include "clients/util/types.h"  // Needs to go first.
+
 #include <granary.h>
 
 #ifdef GRANARY_WHERE_user
@@ -8,28 +10,134 @@ GRANARY_USING_NAMESPACE granary;
 
 namespace {
 enum : size_t {
-  kInitialThreadStackIndex = 63,
-  kMaxThreadStackSize = 256
+  kInitialThreadStackSize = arch::PAGE_SIZE_BYTES / sizeof(AppPC),
+  kMaxThreadStackSize = 1UL << 20,
+
+  // How many frames deep will we look for the frame matching a return
+  // address before assuming that the frame was never recorded?
+  kMaxUnwindDepth = 64
 };
 
-// Stack of return addresses.
-static __thread AppPC tThreadStack[kMaxThreadStackSize] = {nullptr};
-static __thread size_t tThreadStackIndex = kInitialThreadStackIndex;
+// Shadow stack of return addresses. The first slot (`base[0]`) always holds
+// `nullptr`, so that returning from an empty stack never matches.
+struct ThreadStack {
+  // Most recently pushed return address.
+  AppPC *top;
+
+  // Last slot that can be pushed to. Pushing beyond this grows the stack.
+  AppPC *limit;
+
+  // First slot of the stack.
+  AppPC *base;
+
+  // Total number of slots in the stack.
+  size_t num_slots;
+};
+
+// Shared by all threads until they first push a return address.
+static AppPC gEmptyStack[1] = {nullptr};
+
+// Per-thread stack of return addresses. This is accessed directly by inline
+// assembly, relative to the thread base.
+//
+// Note: This depends on a load-time TLS implementation, as is the case on
+//       systems like Linux.
+static __thread __attribute__((tls_model("initial-exec")))
+ThreadStack tThreadStack = {&(gEmptyStack[0]), &(gEmptyStack[0]),
+                            &(gEmptyStack[0]), 1};
+
+// Inline assembly instructions that access the fields of `tThreadStack`. These
+// are formatted at init time because they embed thread-base-relative offsets.
+static char gLoadTopAsm[64] = {'\0'};
+static char gStoreTopAsm[64] = {'\0'};
+static char gCompareLimitAsm[64] = {'\0'};
+
+// Returns the offset of some thread-local field relative to the thread base.
+template <typename T>
+static uintptr_t ThreadOffsetOf(T *field) {
+  return reinterpret_cast<uintptr_t>(field) - os::ThreadBase();
+}
+
+// Allocates page-backed memory for a stack with `num_slots` slots.
+static AppPC *AllocateStack(size_t num_slots) {
+  auto num_bytes = num_slots * sizeof(AppPC);
+  auto mem = mmap(nullptr, num_bytes, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (MAP_FAILED == mem) {
+    os::Log("ERROR: Couldn't map %lu bytes for a stack trace.\n", num_bytes);
+    exit(EXIT_FAILURE);
+  }
+  return reinterpret_cast<AppPC *>(mem);
+}
+
+// Frees this thread's stack memory.
+static void FreeStack(void) {
+  auto &stack(tThreadStack);
+  if (&(gEmptyStack[0]) != stack.base) {
+    munmap(stack.base, stack.num_slots * sizeof(AppPC));
+  }
+  stack.top = &(gEmptyStack[0]);
+  stack.limit = &(gEmptyStack[0]);
+  stack.base = &(gEmptyStack[0]);
+  stack.num_slots = 1;
+}
+
+// Make room for at least one more return address on this thread's stack.
+static void GrowStack(AppPC) {
+  auto &stack(tThreadStack);
+  if (stack.top < stack.limit) return;
+  auto depth = static_cast<size_t>(stack.top - stack.base);
+
+  // At the maximum size; forget about the oldest half of the frames.
+  if (kMaxThreadStackSize <= stack.num_slots) {
+    auto half = depth / 2;
+    memmove(&(stack.base[1]), &(stack.base[1 + half]),
+            (depth - half) * sizeof(AppPC));
+    stack.top -= half;
+    return;
+  }
+
+  auto num_slots = GRANARY_MAX(kInitialThreadStackSize, stack.num_slots * 2);
+  auto base = AllocateStack(num_slots);
+  memcpy(base, stack.base, (depth + 1) * sizeof(AppPC));
+  base[0] = nullptr;
+  FreeStack();
+  stack.base = base;
+  stack.top = &(base[depth]);
+  stack.limit = &(base[num_slots - 1]);
+  stack.num_slots = num_slots;
+}
+
+// Resynchronize the stack when `return_address` doesn't match the top of the
+// stack, e.g. because of a `longjmp` or exception unwinding. If a matching
+// frame is found then the stack is unwound so that the matching frame is on
+// top. Otherwise, `return_address` is pushed so that the subsequent pop
+// leaves the stack unchanged.
+static void UnwindStack(AppPC return_address) {
+  auto &stack(tThreadStack);
+  auto entry = stack.top;
+  for (auto i = 0UL; i < kMaxUnwindDepth && entry > stack.base; ++i, --entry) {
+    if (return_address == *entry) {
+      stack.top = entry;
+      return;
+    }
+  }
+  GrowStack(return_address);
+  *++stack.top = return_address;
+}
 
 }  // namespace
 
 // Copy up to `buff_size` of the most recent program counters from the stack
 // trace into `buff`, and return the number of copied
 size_t CopyStackTrace(AppPC *buff, size_t buff_size) {
-  memset(buff, 0, buff_size);
-  for (auto i = 0UL; i < buff_size; ++i) {
-    auto index = tThreadStackIndex - i;
-    if (!index) return i;
-    auto pc = tThreadStack[index];
-    if (!pc) return i;
-    buff[i] = pc;
+  const auto &stack(tThreadStack);
+  auto i = 0UL;
+  for (auto entry = stack.top; i < buff_size && entry > stack.base; --entry) {
+    buff[i++] = *entry;
   }
-  return buff_size;
+  memset(&(buff[i]), 0, (buff_size - i) * sizeof(AppPC));
+  return i;
 }
 
 // Simple tool for static and dynamic basic block counting.
@@ -38,51 +146,82 @@ class CallStackTracer : public InstrumentationTool {
   virtual ~CallStackTracer(void) = default;
 
   static void Init(InitReason reason) {
-    if (kInitThread == reason) ResetStack();
+    if (kInitProgram == reason || kInitAttach == reason) {
+      auto top = ThreadOffsetOf(&(tThreadStack.top));
+      auto limit = ThreadOffsetOf(&(tThreadStack.limit));
+      Format(gLoadTopAsm, "MOV r64 %%1, m64 FS:[%lu];", top);
+      Format(gStoreTopAsm, "MOV m64 FS:[%lu], r64 %%1;", top);
+      Format(gCompareLimitAsm, "CMP r64 %%1, m64 FS:[%lu];", limit);
+    }
+  }
+
+  // Each thread frees its own stack when it exits. On program exit or
+  // detach, only the calling thread's stack is freed: other threads might
+  // still be executing instrumented code that pushes to or pops from their
+  // stacks, and the process is about to go away anyway.
+  static void Exit(ExitReason) {
+    FreeStack();
   }
 
   // Add in instrumentation at the target of function calls
   virtual void InstrumentBlock(DecodedBlock *block) {
     for (auto succ : block->Successors()) {
-
-      // Push the return address on the stack.
       if (succ.cfi->IsFunctionCall()) {
         if (IsA<NativeBlock *>(succ.block)) continue;
-
-        auto return_address = succ.cfi->DecodedPC() + succ.cfi->DecodedLength();
-        succ.cfi->InsertBefore(
-            lir::InlineFunctionCall(block, EnterFunction, return_address));
-
-      // Pop the return address off the stack.
+        PushReturnAddress(block, succ.cfi);
       } else if (succ.cfi->IsFunctionReturn()) {
-        MemoryOperand ret_addr(arch::REG_RSP, arch::ADDRESS_WIDTH_BYTES);
-        succ.cfi->InsertBefore(
-            lir::InlineFunctionCall(block, LeaveFunction, ret_addr));
+        PopReturnAddress(block, succ.cfi);
       }
     }
   }
 
  protected:
-
-  static void ResetStack(void) {
-    memset(tThreadStack, 0, sizeof tThreadStack);
-    tThreadStackIndex = kInitialThreadStackIndex;
+  // Push the return address of a function call onto the stack.
+  static void PushReturnAddress(DecodedBlock *block,
+                                ControlFlowInstruction *call) {
+    auto return_address = call->DecodedPC() + call->DecodedLength();
+    ImmediateOperand ret_addr(return_address);
+    lir::InlineAssembly asm_(ret_addr);
+
+    // %0 is the return address.
+    // %1 is the top of the stack.
+    // %2 labels the fast path.
+    // %3 is a temporary.
+    asm_.InlineBefore(call, gLoadTopAsm);
+    asm_.InlineBefore(call, gCompareLimitAsm);
+    asm_.InlineBefore(call, "JB l %2;"_x86_64);
+    call->InsertBefore(lir::InlineFunctionCall(block, GrowStack,
+                                               return_address));
+    asm_.InlineBefore(call, gLoadTopAsm);
+    asm_.InlineBefore(call,
+        "@LABEL %2:"
+        "LEA r64 %1, m64 [%1 + 8];"
+        "MOV r64 %3, i64 %0;"
+        "MOV m64 [%1], r64 %3;"_x86_64);
+    asm_.InlineBefore(call, gStoreTopAsm);
   }
 
-  // Enter a function.
-  static void EnterFunction(AppPC return_address) {
-    if (GRANARY_UNLIKELY(tThreadStackIndex >= kMaxThreadStackSize)) {
-      ResetStack();
-    }
-    tThreadStack[++tThreadStackIndex] = return_address;
-  }
-
-  // Leave a function.
-  static void LeaveFunction(AppPC return_address) {
-    if (!tThreadStackIndex ||
-        return_address != tThreadStack[tThreadStackIndex--]) {
-      ResetStack();
-    }
+  // Pop the return address of a function return off of the stack.
+  static void PopReturnAddress(DecodedBlock *block,
+                               ControlFlowInstruction *ret) {
+    MemoryOperand ret_addr(arch::REG_RSP, arch::ADDRESS_WIDTH_BYTES);
+    lir::InlineAssembly asm_(ret_addr);
+
+    // %0 is the return address.
+    // %1 is the top of the stack.
+    // %2 labels the fast path.
+    // %3 is a temporary.
+    asm_.InlineBefore(ret, gLoadTopAsm);
+    asm_.InlineBefore(ret,
+        "MOV r64 %3, m64 %0;"
+        "CMP r64 %3, m64 [%1];"
+        "JZ l %2;"_x86_64);
+    ret->InsertBefore(lir::InlineFunctionCall(block, UnwindStack, ret_addr));
+    asm_.InlineBefore(ret, gLoadTopAsm);
+    asm_.InlineBefore(ret,
+        "@LABEL %2:"
+        "SUB r64 %1, i8 8;"_x86_64);
+    asm_.InlineBefore(ret, gStoreTopAsm);
   }
 };
 
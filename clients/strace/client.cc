@@ -8,6 +8,15 @@
 
 GRANARY_DECLARE_bool(hook_syscalls);
 
+GRANARY_DEFINE_string(strace_record_file, "",
+    "Path to a file to which binary system call records are appended. If "
+    "specified, then each thread buffers fixed-size records in memory and "
+    "writes them out in batches, instead of logging one line of text per "
+    "system call. The records can be formatted as text using the "
+    "`clients/strace/format_records.py` script. The default is to log text.",
+
+    "strace");
+
 #include "clients/user/client.h"
 
 GRANARY_USING_NAMESPACE granary;
@@ -348,38 +357,215 @@ enum {
   NUM_SYSCALLS = sizeof kSystemCallNames / sizeof kSystemCallNames[0]
 };
 
-static __thread uint64_t tSyscallNumber = 0;
-static __thread uint64_t tSyscallArg0 = 0;
-static __thread uint64_t tSyscallArg1 = 0;
-static __thread uint64_t tSyscallArg2 = 0;
-static __thread uint64_t tSyscallArg3 = 0;
-static __thread uint64_t tSyscallArg4 = 0;
-static __thread uint64_t tSyscallArg5 = 0;
+#ifndef __X32_SYSCALL_BIT
+# define __X32_SYSCALL_BIT 0x40000000UL
+#endif
+
+// Returns the name of the system call `number`, or `nullptr` if the system
+// call is unknown. x32 system calls are looked up by their x86-64 number.
+static const char *SystemCallName(uint64_t number) {
+  if (NUM_SYSCALLS <= number) {
+    number &= ~static_cast<uint64_t>(__X32_SYSCALL_BIT);
+  }
+  if (NUM_SYSCALLS <= number) return nullptr;
+  return kSystemCallNames[number];
+}
+
+// A fixed-size record of a single system call. Binary records are formatted
+// offline by `format_records.py`.
+struct SystemCallRecord {
+  uint64_t number;
+  uint64_t args[6];
+  uint64_t return_value;
+
+  // Cycle count at the time the system call returned.
+  uint64_t timestamp;
+  uint64_t thread_id;
+};
+
+enum {
+  kNumBufferedRecords = 64
+};
+
+// Per-thread ring buffer of completed system call records.
+//
+// Only the owning thread appends records. Records in the range
+// `[num_claimed, num_published)` are complete and not yet flushed. A flusher
+// (either the owning thread or the thread exiting the program) claims that
+// range by advancing `num_claimed`, writes it out, and then advances
+// `num_written`, which lets the owning thread reuse those slots.
+struct RecordBuffer {
+  GRANARY_DEFINE_NEW_ALLOCATOR(RecordBuffer, {
+    kAlignment = arch::CACHE_LINE_SIZE_BYTES
+  })
+
+  // Next buffer in `gRecordBuffers`. Buffers are never removed from this
+  // list; instead, a buffer freed by an exiting thread is reused by the next
+  // new thread.
+  RecordBuffer *next;
+
+  // Whether or not some thread currently owns this buffer.
+  std::atomic<bool> is_owned;
+
+  uint64_t thread_id;
+
+  std::atomic<uint64_t> num_published;
+  std::atomic<uint64_t> num_claimed;
+  std::atomic<uint64_t> num_written;
+
+  SystemCallRecord records[kNumBufferedRecords];
+};
+
+// File descriptor of the binary record file, or `-1` if system calls are
+// logged as text.
+static int gRecordFd = -1;
+
+// List of every record buffer, so that all buffered records can be flushed
+// when the program exits.
+static std::atomic<RecordBuffer *> gRecordBuffers = ATOMIC_VAR_INIT(nullptr);
+
+// The system call currently in progress in this thread.
+static __thread SystemCallRecord tRecord;
+
+// This thread's record buffer. This is allocated on this thread's first
+// system call exit.
+static __thread RecordBuffer *tRecordBuffer = nullptr;
+
+// Write out `num_bytes` bytes of `data` to the record file, retrying on short
+// writes and on interrupted writes.
+static void WriteRecords(const void *data, size_t num_bytes) {
+  auto bytes = reinterpret_cast<const char *>(data);
+  while (num_bytes) {
+    auto ret = sys_write(gRecordFd, bytes, num_bytes);
+    if (-EINTR == ret) continue;
+    if (0 >= ret) return;
+    bytes += ret;
+    num_bytes -= static_cast<size_t>(ret);
+  }
+}
+
+// Append a buffer's published records to the record file. This can be called
+// concurrently by the thread that owns `buffer` and by the thread that exits
+// the program.
+static void FlushRecords(RecordBuffer *buffer) {
+  auto begin = buffer->num_claimed.load(std::memory_order_relaxed);
+  uint64_t end = 0;
+  do {
+    end = buffer->num_published.load(std::memory_order_acquire);
+    if (begin == end) return;
+  } while (!buffer->num_claimed.compare_exchange_weak(
+      begin, end, std::memory_order_acquire, std::memory_order_relaxed));
+
+  if (-1 != gRecordFd) {
+    auto first = begin % kNumBufferedRecords;
+    auto last = end % kNumBufferedRecords;
+    if (first < last || !last) {
+      WriteRecords(&(buffer->records[first]),
+                   (end - begin) * sizeof(SystemCallRecord));
+    } else {
+      WriteRecords(&(buffer->records[first]),
+                   (kNumBufferedRecords - first) * sizeof(SystemCallRecord));
+      WriteRecords(&(buffer->records[0]), last * sizeof(SystemCallRecord));
+    }
+  }
+
+  // Claimed ranges are written back in the order in which they were claimed.
+  while (begin != buffer->num_written.load(std::memory_order_acquire)) {
+    arch::Relax();
+  }
+  buffer->num_written.store(end, std::memory_order_release);
+}
+
+// Gives this thread ownership of a record buffer, reusing the buffer of an
+// exited thread if possible.
+static RecordBuffer *AllocateRecordBuffer(void) {
+  auto buffer = gRecordBuffers.load(std::memory_order_acquire);
+  for (; buffer; buffer = buffer->next) {
+    auto is_owned = false;
+    if (!buffer->is_owned.load(std::memory_order_relaxed) &&
+        buffer->is_owned.compare_exchange_strong(is_owned, true)) {
+      break;
+    }
+  }
+  if (!buffer) {
+    buffer = new RecordBuffer;
+    buffer->is_owned.store(true, std::memory_order_relaxed);
+    buffer->num_published.store(0, std::memory_order_relaxed);
+    buffer->num_claimed.store(0, std::memory_order_relaxed);
+    buffer->num_written.store(0, std::memory_order_relaxed);
+    buffer->next = gRecordBuffers.load(std::memory_order_relaxed);
+    while (!gRecordBuffers.compare_exchange_weak(
+        buffer->next, buffer, std::memory_order_release,
+        std::memory_order_relaxed)) {}
+  }
+  buffer->thread_id = static_cast<uint64_t>(sys_gettid());
+  return buffer;
+}
+
+// Flushes this thread's records, then gives up ownership of its record
+// buffer.
+static void FreeRecordBuffer(void) {
+  auto buffer = tRecordBuffer;
+  if (!buffer) return;
+  tRecordBuffer = nullptr;
+  FlushRecords(buffer);
+  buffer->is_owned.store(false, std::memory_order_release);
+}
+
+// Flushes the published records of every thread.
+static void FlushAllRecords(void) {
+  auto buffer = gRecordBuffers.load(std::memory_order_acquire);
+  for (; buffer; buffer = buffer->next) {
+    FlushRecords(buffer);
+  }
+}
 
 static void TraceSyscallEntry(SystemCallContext ctx) {
-  tSyscallNumber = ctx.Number();
-  tSyscallArg0 = ctx.Arg0();
-  tSyscallArg1 = ctx.Arg1();
-  tSyscallArg2 = ctx.Arg2();
-  tSyscallArg3 = ctx.Arg3();
-  tSyscallArg4 = ctx.Arg4();
-  tSyscallArg5 = ctx.Arg5();
+  auto &record(tRecord);
+  record.number = ctx.Number();
+  record.args[0] = ctx.Arg0();
+  record.args[1] = ctx.Arg1();
+  record.args[2] = ctx.Arg2();
+  record.args[3] = ctx.Arg3();
+  record.args[4] = ctx.Arg4();
+  record.args[5] = ctx.Arg5();
 }
 
 static void TraceSyscallExit(SystemCallContext ctx) {
-  if (tSyscallNumber < NUM_SYSCALLS) {
-    os::Log("%s\t%lx\t%lx\t%lx\t%lx\t%lx\t%lx\t= %lx\n",
-            kSystemCallNames[tSyscallNumber], tSyscallArg0, tSyscallArg1,
-            tSyscallArg2, tSyscallArg3, tSyscallArg4, tSyscallArg5,
-            ctx.ReturnValue());
+  auto &record(tRecord);
+  if (-1 == gRecordFd) {
+    char unknown_name[32];
+    auto name = SystemCallName(record.number);
+    if (!name) {
+      Format(unknown_name, sizeof unknown_name, "syscall_%lu", record.number);
+      name = unknown_name;
+    }
+    os::Log("%s\t%lx\t%lx\t%lx\t%lx\t%lx\t%lx\t= %lx\n", name,
+            record.args[0], record.args[1], record.args[2], record.args[3],
+            record.args[4], record.args[5], ctx.ReturnValue());
+    memset(&record, 0, sizeof record);
+    return;
+  }
+  auto buffer = tRecordBuffer;
+  if (GRANARY_UNLIKELY(!buffer)) {
+    buffer = tRecordBuffer = AllocateRecordBuffer();
+  }
+  record.return_value = ctx.ReturnValue();
+  record.timestamp = arch::CycleCount();
+  record.thread_id = buffer->thread_id;
+
+  // Only this thread publishes records, so the ring buffer is full when every
+  // slot holds a record that has not yet been written out.
+  auto index = buffer->num_published.load(std::memory_order_relaxed);
+  while (GRANARY_UNLIKELY(kNumBufferedRecords <= (
+      index - buffer->num_written.load(std::memory_order_acquire)))) {
+    FlushRecords(buffer);
+  }
+  buffer->records[index % kNumBufferedRecords] = record;
+  buffer->num_published.store(index + 1, std::memory_order_release);
+  if (GRANARY_UNLIKELY(!((index + 1) % kNumBufferedRecords))) {
+    FlushRecords(buffer);
   }
-  tSyscallNumber = 0;
-  tSyscallArg0 = 0;
-  tSyscallArg1 = 0;
-  tSyscallArg2 = 0;
-  tSyscallArg3 = 0;
-  tSyscallArg4 = 0;
-  tSyscallArg5 = 0;
 }
 
 }  // namespace
@@ -390,9 +576,29 @@ class SystemCallTracer : public InstrumentationTool {
   virtual ~SystemCallTracer(void) = default;
   static void Init(InitReason reason) {
     if (kInitThread == reason) return;
+    if (FLAG_strace_record_file[0]) {
+      gRecordFd = open(FLAG_strace_record_file, O_WRONLY | O_CREAT | O_APPEND,
+                       0644);
+      if (0 > gRecordFd) {
+        os::Log("Unable to open strace record file %s.\n",
+                FLAG_strace_record_file);
+        gRecordFd = -1;
+      }
+    }
     AddSystemCallEntryFunction(TraceSyscallEntry);
     AddSystemCallExitFunction(TraceSyscallExit);
   }
+
+  static void Exit(ExitReason reason) {
+    FreeRecordBuffer();
+    if (kExitThread != reason) {
+      FlushAllRecords();
+      if (-1 != gRecordFd) {
+        close(gRecordFd);
+        gRecordFd = -1;
+      }
+    }
+  }
 };
 
 // Initialize the `strace` tool.
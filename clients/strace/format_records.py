@@ -0,0 +1,51 @@
+"""Format the binary system call records written by the `strace` client when
+`--strace_record_file` is used.
+
+Usage: python format_records.py <record file>
+
+Author:     Peter Goodman (peter.goodman@gmail.com)
+Copyright:  Copyright 2015 Peter Goodman, all rights reserved."""
+
+import os
+import re
+import struct
+import sys
+
+# Mirrors `SystemCallRecord` in `client.cc`: number, 6 arguments, return
+# value, timestamp, and thread id.
+RECORD = struct.Struct("<10Q")
+
+# Matches entries like `[__NR_read] = "read",  // 0` in `client.cc`.
+# System calls made using the x32 ABI have this bit set in their numbers.
+X32_SYSCALL_BIT = 0x40000000
+
+SYSCALL_NAME = re.compile(r'\[__NR_[a-zA-Z0-9_]+\] = "([a-zA-Z0-9_]+)",?\s*//\s*([0-9]+)')
+
+
+def read_syscall_names():
+  names = {}
+  client_cc = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                           "client.cc")
+  with open(client_cc, "r") as lines:
+    for line in lines:
+      m = SYSCALL_NAME.search(line)
+      if m:
+        names[int(m.group(2))] = m.group(1)
+  return names
+
+
+if "__main__" == __name__:
+  names = read_syscall_names()
+  with open(sys.argv[1], "rb") as records:
+    while True:
+      data = records.read(RECORD.size)
+      if len(data) < RECORD.size:
+        break
+      fields = RECORD.unpack(data)
+      nr, args, ret, timestamp, tid = (fields[0], fields[1:7], fields[7],
+                                       fields[8], fields[9])
+      name = names.get(nr) or names.get(nr & ~X32_SYSCALL_BIT,
+                                         "syscall_{}".format(nr))
+      print("{}\t{}\t{}\t{}\t= {:x}".format(
+          tid, timestamp, name, "\t".join("{:x}".format(a) for a in args),
+          ret))
@@ -49,11 +49,35 @@ static void UnmapMemory(SystemCallContext ctx) {
 static ClosureList<SystemCallContext> gEntryHooks GRANARY_GLOBAL;
 static ClosureList<SystemCallContext> gExitHooks GRANARY_GLOBAL;
 
+enum : uint64_t {
+  // System call numbers at or above this are always seen by the entry hooks.
+  // This includes x32 system calls (e.g. `exit_group | __X32_SYSCALL_BIT`).
+  kMaxHookedSystemCallNumber = 512,
+  kNumHookedSystemCallWords = kMaxHookedSystemCallNumber / 64
+};
+
+// Bitmap of the system call numbers that at least one entry hook is
+// interested in. This is tested inline before each system call.
+static uint64_t gHookedSystemCalls[kNumHookedSystemCallWords] = {0};
+
+// Does some entry hook want to see every system call?
+static bool gHookAllSystemCalls = false;
+
+// Mark a system call number as being interesting to an entry hook. Numbers
+// at or above `kMaxHookedSystemCallNumber` are always hooked.
+static void HookSystemCall(uint64_t number) {
+  if (kMaxHookedSystemCallNumber > number) {
+    gHookedSystemCalls[number / 64] |= 1ULL << (number % 64);
+  }
+}
+
 // Deletes all hooks and restores the syscall hooking system to its original
 // state. This is done during `User::Exit`.
 static void RemoveAllHooks(void) {
   gEntryHooks.Reset();
   gExitHooks.Reset();
+  gHookAllSystemCalls = false;
+  memset(gHookedSystemCalls, 0, sizeof gHookedSystemCalls);
 }
 
 // Trigger an exit when the program is killed.
@@ -109,6 +133,16 @@ void HookSystemCallExit(arch::MachineContext *context) {
 // Register a function to be called before a system call is made.
 void AddSystemCallEntryFunction(SystemCallHook *callback) {
   if (!FLAG_hook_syscalls) return;
+  gHookAllSystemCalls = true;
+  gEntryHooks.Add(callback);
+}
+
+// Register a function to be called before a system call whose number is in
+// `numbers` is made.
+void AddSystemCallEntryFunction(SystemCallHook *callback,
+                                std::initializer_list<uint64_t> numbers) {
+  if (!FLAG_hook_syscalls) return;
+  for (auto number : numbers) HookSystemCall(number);
   gEntryHooks.Add(callback);
 }
 
@@ -127,6 +161,11 @@ class UserSpaceInstrumenter : public InstrumentationTool {
     if (kInitProgram == reason || kInitAttach == reason) {
       TryHandleSignal(SIGTERM, ExitOnSignal);
       TryHandleSignal(SIGINT, ExitOnSignal);
+
+      // System calls that `HookSystemCallEntry` itself handles.
+      HookSystemCall(__NR_exit_group);
+      HookSystemCall(__NR_exit);
+      HookSystemCall(__NR_munmap);
     }
   }
 
@@ -159,14 +198,44 @@ class UserSpaceInstrumenter : public InstrumentationTool {
   // Adds in the hooks that allow other tools (including this tool) to hook
   // the system call handlers in high-level way.
   void InstrumentSyscall(ControlFlowInstruction *syscall) {
-    // Unconditionally pre-instrument syscalls so we can see `munmap`s and
-    // `exit_group`s.
-    syscall->InsertBefore(lir::ContextFunctionCall(HookSystemCallEntry));
+    if (gHookAllSystemCalls) {
+      syscall->InsertBefore(lir::ContextFunctionCall(HookSystemCallEntry));
+    } else {
+      InstrumentHookedSyscall(syscall);
+    }
 
     if (!gExitHooks.IsEmpty()) {
       syscall->InsertAfter(lir::ContextFunctionCall(HookSystemCallExit));
     }
   }
+
+  // Only switch into the entry hooks if the number of the system call is one
+  // that some hook (including this tool) is interested in, e.g. `munmap` and
+  // `exit_group`, or if the number is too big for the bitmap, e.g. because it
+  // is an x32 system call.
+  void InstrumentHookedSyscall(ControlFlowInstruction *syscall) {
+    RegisterOperand number(os::abi::SystemCallNumberRegister());
+    ImmediateOperand max_number(kMaxHookedSystemCallNumber, 4);
+    ImmediateOperand bitmap(&(gHookedSystemCalls[0]));
+    lir::InlineAssembly asm_(number, max_number, bitmap);
+
+    // %0 is the system call number.
+    // %1 is the maximum hooked system call number.
+    // %2 is the address of the bitmap of hooked system call numbers.
+    // %3 is a virtual register holding the bitmap address.
+    // %4 labels the system call.
+    // %5 labels the call to the entry hooks.
+    asm_.InlineBefore(syscall,
+        "CMP r64 %0, i32 %1;"
+        "JNB l %5;"
+        "MOV r64 %3, i64 %2;"
+        "BT m64 [%3], r64 %0;"
+        "JNB l %4;"
+        "@LABEL %5:"_x86_64);
+    syscall->InsertBefore(lir::ContextFunctionCall(HookSystemCallEntry));
+    asm_.InlineBefore(syscall,
+        "@LABEL %4:"_x86_64);
+  }
 };
 
 // Initialize the `user` tool.
@@ -55,6 +55,18 @@ typedef void (SystemCallHook)(SystemCallContext context);
 // hook is removed.
 void AddSystemCallEntryFunction(SystemCallHook *hook);
 
+// Register a function to be called before a system call whose number is in
+// `numbers` is made. System calls whose numbers no hook is interested in skip
+// the (expensive) context switch into the hooks entirely.
+//
+// Note: The function might also be called for other system calls, so it must
+//       check `SystemCallContext::Number`.
+//
+// Note: This must be called before any code is instrumented, e.g. in a tool's
+//       `Init` function.
+void AddSystemCallEntryFunction(SystemCallHook *hook,
+                                std::initializer_list<uint64_t> numbers);
+
 // Register a function to be called after a system call is made. `data` is
 // a pointer to some opaque data structure which will be passed to the callback.
 // `delete_data` is a function that will clean up `data`s memory when the
@@ -24,8 +24,37 @@ class Closure {
 
   GRANARY_DISALLOW_COPY_AND_ASSIGN(Closure);
 };
+
+enum : size_t {
+  // Maximum number of closures that can be frozen into an array. Any
+  // remaining closures are applied by walking the list.
+  kMaxNumFrozenClosures = 8
+};
+
+// Immutable array of closures. Once published by a `ClosureList`, this is
+// never modified.
+class FrozenClosures {
+ public:
+  FrozenClosures(void) = default;
+
+  GRANARY_DEFINE_NEW_ALLOCATOR(FrozenClosures, {
+    kAlignment = 1
+  })
+
+  size_t num_closures;
+  uintptr_t callback_addrs[kMaxNumFrozenClosures];
+
+  // Closures that didn't fit into `callback_addrs`.
+  Closure *unfrozen;
+
+ private:
+  GRANARY_DISALLOW_COPY_AND_ASSIGN(FrozenClosures);
+};
 }  // namespace detail
 
+// List of closures. Closures are added during tool initialization, and the
+// list is frozen into an immutable array the first time that the closures are
+// applied. No closures can be added to a frozen list.
 template <typename... Args>
 class ClosureList {
  public:
@@ -35,7 +64,8 @@ class ClosureList {
 
   ClosureList(void)
       : first(nullptr),
-        next_ptr(&first) {}
+        next_ptr(&first),
+        frozen(nullptr) {}
 
   ~ClosureList(void) {
     FreeAll();
@@ -43,6 +73,7 @@ class ClosureList {
 
   // Reset the closure list to its initial state.
   void Reset(void) {
+    granary::SpinLockedRegion locker(&lock);
     FreeAll();
     first = nullptr;
     next_ptr = &first;
@@ -52,13 +83,19 @@ class ClosureList {
   void Add(void (*callback)(Args...)) {
     auto closure = new detail::Closure(reinterpret_cast<uintptr_t>(callback));
     granary::SpinLockedRegion locker(&lock);
+    GRANARY_ASSERT(!frozen.load(std::memory_order_relaxed));
     *next_ptr = closure;
     next_ptr = &(closure->next);
   }
 
   // Apply all closures to some arguments.
   inline void ApplyAll(Args... args) const {
-    for (auto closure : ClosureTypeIterator(first)) {
+    auto closures = frozen.load(std::memory_order_acquire);
+    if (GRANARY_UNLIKELY(!closures)) closures = Freeze();
+    for (auto i = 0UL; i < closures->num_closures; ++i) {
+      reinterpret_cast<CallbackType *>(closures->callback_addrs[i])(args...);
+    }
+    for (auto closure : ClosureTypeIterator(closures->unfrozen)) {
       reinterpret_cast<CallbackType *>(closure->callback_addr)(args...);
     }
   }
@@ -68,16 +105,40 @@ class ClosureList {
   }
 
  private:
+  // Freeze (up to `kMaxNumFrozenClosures` of) the closures into an array, and
+  // publish the array.
+  const detail::FrozenClosures *Freeze(void) const {
+    granary::SpinLockedRegion locker(&lock);
+    if (auto closures = frozen.load(std::memory_order_relaxed)) {
+      return closures;
+    }
+    auto closures = new detail::FrozenClosures;
+    auto closure = first;
+    auto num_closures = 0UL;
+    for (; closure && num_closures < detail::kMaxNumFrozenClosures;
+         closure = closure->next) {
+      closures->callback_addrs[num_closures++] = closure->callback_addr;
+    }
+    closures->num_closures = num_closures;
+    closures->unfrozen = closure;
+    frozen.store(closures, std::memory_order_release);
+    return closures;
+  }
+
   void FreeAll(void) {
     for (ClosureType *next_closure(nullptr); first; first = next_closure) {
       next_closure = first->next;
       delete first;
     }
+    delete frozen.exchange(nullptr);
   }
 
-  granary::SpinLock lock;
+  mutable granary::SpinLock lock;
   ClosureType *first;
   ClosureType **next_ptr;
+
+  // Array of closures, published when the list is frozen.
+  mutable std::atomic<const detail::FrozenClosures *> frozen;
 };
 
 #endif  // CLIENTS_UTIL_CLOSURE_H_
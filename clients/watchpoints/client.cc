@@ -41,9 +41,11 @@ class Watchpoints : public InstrumentationTool {
     if (kInitProgram == reason || kInitAttach == reason) {
       InitUserWatchpoints();
       AddMemOpInstrumenter(InstrumentMemOp);
+      AddMemOpGroupInstrumenter(InstrumentMemOpGroup);
 
       unwatched_addr[0] = AllocateVirtualRegister();
       unwatched_addr[1] = AllocateVirtualRegister();
+      watched_addr = AllocateVirtualRegister();
     }
   }
 
@@ -55,16 +57,27 @@ class Watchpoints : public InstrumentationTool {
 
  private:
 
+  // Returns true if the memory operand `mloc` of `instr`, which is part of a
+  // `MemoryOperandGroup`, is checked once for its whole group by
+  // `InstrumentMemOpGroup`, instead of by `InstrumentMemOp`.
+  static bool IsCheckedByGroup(NativeInstruction *instr,
+                               const MemoryOperand &mloc) {
+    return mloc.IsModifiable() &&
+           !IsA<ExceptionalControlFlowInstruction *>(instr);
+  }
+
   // Instrument an individual memory operand.
   static void InstrumentMemOp(const InstrumentedMemoryOperand &op) {
     // Ignore addresses stored in non-GPRs (e.g. accesses to the stack).
     auto watched_addr = op.native_addr_op.Register();
     if (watched_addr.IsStackPointerAlias()) return;
+    if (op.is_grouped && IsCheckedByGroup(op.instr, op.native_mem_op)) return;
 
     RegisterOperand unwatched_addr_reg(unwatched_addr[op.operand_number]);
     RegisterOperand watched_addr_reg(op.native_addr_op);
-    WatchedMemoryOperand client_op = {op.block, op.instr, op.native_mem_op,
-                                      unwatched_addr_reg, watched_addr_reg};
+    WatchedMemoryOperand client_op = {op.block, op.instr, op.instr,
+                                      op.native_mem_op, unwatched_addr_reg,
+                                      watched_addr_reg};
 
     lir::InlineAssembly asm_(unwatched_addr_reg, watched_addr_reg);
 
@@ -118,10 +131,97 @@ class Watchpoints : public InstrumentationTool {
     }
   }
 
+  // Match the memory operand `op` from its instruction into one of `mlocs`.
+  static MemoryOperand &MatchGroupedMemOp(const GroupedMemoryOperand &op,
+                                          MemoryOperand (&mlocs)[2]) {
+    GRANARY_IF_DEBUG( auto num_matched = ) op.instr->CountMatchedOperands(
+        ReadOrWriteTo(mlocs[0]), ReadOrWriteTo(mlocs[1]));
+    GRANARY_ASSERT(op.operand_number < num_matched);
+    return mlocs[op.operand_number];
+  }
+
+  // Instrument a group of memory operands that share a base register. The
+  // base register is checked for a watched address once, before the first
+  // memory operand of the group, and then each memory operand of the group is
+  // changed to use the unwatched base address.
+  static void InstrumentMemOpGroup(const MemoryOperandGroup &group) {
+    if (group.base_reg_op.Register().IsStackPointer()) return;
+
+    auto is_checked = false;
+    for (auto i = 0UL; i < group.num_ops && !is_checked; ++i) {
+      MemoryOperand mlocs[2];
+      auto &op(group.ops[i]);
+      is_checked = IsCheckedByGroup(op.instr, MatchGroupedMemOp(op, mlocs));
+    }
+    if (!is_checked) return;
+
+    RegisterOperand unwatched_base_reg(group.block->AllocateVirtualRegister());
+    RegisterOperand watched_base_reg(group.base_reg_op);
+    lir::InlineAssembly asm_(unwatched_base_reg, watched_base_reg);
+    asm_.InlineBefore(group.first_instr,
+        "MOV r64 %0, r64 %1;"
+        "BT r64 %0, i8 48;"  // Test the discriminating bit (bit 48).
+        GRANARY_IF_USER_ELSE("JNB", "JB") " l %2;"
+        "  @COLD;"
+        "  SHL r64 %0, i8 16;"
+        "  SAR r64 %0, i8 16;"_x86_64);
+
+    // Allow all hooked tools to see the watched and unwatched address of each
+    // memory operand of the group.
+    if (!gWatchpointHooks.IsEmpty()) {
+      RegisterOperand unwatched_addr_reg(unwatched_addr[0]);
+      RegisterOperand watched_addr_reg(watched_addr);
+      for (auto i = 0UL; i < group.num_ops; ++i) {
+        MemoryOperand mlocs[2];
+        auto &op(group.ops[i]);
+        auto &mloc(MatchGroupedMemOp(op, mlocs));
+        if (!IsCheckedByGroup(op.instr, mloc)) continue;
+
+        ImmediateOperand disp(op.displacement, arch::ADDRESS_WIDTH_BYTES);
+        lir::InlineAssembly addr_asm(unwatched_base_reg, watched_base_reg,
+                                     unwatched_addr_reg, watched_addr_reg,
+                                     disp);
+        addr_asm.InlineBefore(group.first_instr,
+            "LEA r64 %2, m64 [%0 + %4];"
+            "LEA r64 %3, m64 [%1 + %4];"_x86_64);
+        WatchedMemoryOperand client_op = {group.block, op.instr,
+                                          group.first_instr, mloc,
+                                          unwatched_addr_reg, watched_addr_reg};
+        gWatchpointHooks.ApplyAll(client_op);
+      }
+    }
+
+    asm_.InlineBefore(group.first_instr,
+        "@LABEL %2:"_x86_64);
+
+    // Replace each memory operand with its unwatched address.
+    for (auto i = 0UL; i < group.num_ops; ++i) {
+      MemoryOperand mlocs[2];
+      auto &op(group.ops[i]);
+      auto &mloc(MatchGroupedMemOp(op, mlocs));
+      if (!IsCheckedByGroup(op.instr, mloc)) continue;
+
+      auto addr_reg = unwatched_base_reg.Register();
+      if (op.displacement) {
+        addr_reg = unwatched_addr[op.operand_number];
+        RegisterOperand unwatched_addr_reg(addr_reg);
+        ImmediateOperand disp(op.displacement, arch::ADDRESS_WIDTH_BYTES);
+        lir::InlineAssembly addr_asm(unwatched_base_reg, unwatched_addr_reg,
+                                     disp);
+        addr_asm.InlineBefore(op.instr, "LEA r64 %1, m64 [%0 + %2];"_x86_64);
+      }
+      MemoryOperand unwatched_addr_mloc(addr_reg, mloc.ByteWidth());
+      GRANARY_IF_DEBUG( auto ret = ) mloc.TryReplaceWith(unwatched_addr_mloc);
+      GRANARY_ASSERT(ret);
+    }
+  }
+
   static VirtualRegister unwatched_addr[2];
+  static VirtualRegister watched_addr;
 };
 
 VirtualRegister Watchpoints::unwatched_addr[2];
+VirtualRegister Watchpoints::watched_addr;
 
 namespace {
 enum : uintptr_t {
@@ -12,6 +12,12 @@ class WatchedMemoryOperand {
   // Instruction that contains the memory operand `mem_op`.
   granary::NativeInstruction * const instr;
 
+  // Instruction before which code that depends on the watched address should
+  // be placed. This is `instr`, unless `mem_op` is checked as part of a group
+  // of memory operands that share a base register, in which case this is the
+  // first instruction of the group.
+  granary::NativeInstruction * const instrument_instr;
+
   // Memory operand that de-references a potentially watched address.
   const granary::MemoryOperand &mem_op;
 
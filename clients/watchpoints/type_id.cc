@@ -5,69 +5,131 @@
 GRANARY_USING_NAMESPACE granary;
 
 namespace {
-enum {
-  kMaxSetBit = 31,
-  kTypeTableSize = 4096
+enum : uint64_t {
+  kMaxSizeOrder = 63,
+
+  // Type IDs at the end of the type ID space are reserved for when we run out
+  // of type IDs. Rather than dropping new types, they degrade into one type
+  // per size order, i.e. we lose the allocation site but not the size.
+  kNumOverflowTypeIds = kMaxSizeOrder + 1,
+  kFirstOverflowTypeId = kMaxWatchpointTypeId - kNumOverflowTypeIds,
+
+  // The type table is open-addressed, and at most half full.
+  kTypeTableSizeLog2 = 16,
+  kTypeTableSize = 1ULL << kTypeTableSizeLog2,
+
+  // Number of recently used types cached by each thread.
+  kThreadCacheSize = 8
 };
 
+static_assert(kTypeTableSize >= (2 * kMaxWatchpointTypeId),
+              "The type table must be at least twice as big as the number of "
+              "type IDs.");
+
 // Uses a combination of (return address, log2 size) to identify a type.
 struct Type {
-  const Type *next;
-  size_t size_order;
   uintptr_t ret_address;
+  size_t size_order;
 };
 
-typedef LinkedListIterator<const Type> ConstTypeIterator;
+// Array of types, indexed by type ID.
+static Type gTypes[kMaxWatchpointTypeId];
+
+// An entry in the type table. Entries are claimed by atomically setting `key`,
+// and then published by setting `id` to one more than the type ID.
+struct TypeTableEntry {
+  std::atomic<uint64_t> key;
+  std::atomic<uint64_t> id;
+};
 
-// Array of types for serving type allocations.
-static Type gTypes[kMaxWatchpointTypeId + 1];
+// Lock-free, open-addressed hash table mapping type keys to type IDs.
+static TypeTableEntry gTypeTable[kTypeTableSize];
 
 // Did we run out of type ids?
-static bool gNoMoreTypeIds = false;
-
-// Array of `Type` lists, with locks protecting each list.
-struct TypeList {
-  ReaderWriterLock types_lock;
-  const Type *types;
-} static gTypeTable[kTypeTableSize];
-
-// Search the type lists for the matching type.
-static const Type *FindType(TypeList *ls, uint64_t ret_address, size_t size) {
-  for (auto type : ConstTypeIterator(ls->types)) {
-    if (type->ret_address == ret_address && type->size_order == size) {
-      return type;
-    }
-  }
-  return nullptr;
-}
+static std::atomic<bool> gNoMoreTypeIds = ATOMIC_VAR_INIT(false);
 
 // The next type Id that can be assigned.
-static std::atomic<uint64_t> gNextTypeId;
+static std::atomic<uint64_t> gNextTypeId = ATOMIC_VAR_INIT(0);
+
+#ifdef GRANARY_WHERE_user
+// Incremented each time the type table is reset, so that stale per-thread
+// cache entries are ignored.
+static std::atomic<uint64_t> gTypeTableVersion = ATOMIC_VAR_INIT(0);
+
+// A recently used type.
+struct CachedType {
+  uint64_t key;
+  uint64_t version;
+  uint64_t id;
+};
 
-static uint16_t IdOf(const Type *type) {
-  return static_cast<uint16_t>(type - &(gTypes[0]));
+// Per-thread cache of recently used types. Most allocations come from a small
+// number of hot allocation sites, so this avoids probing the type table.
+static __thread CachedType tTypeCache[kThreadCacheSize];
+#endif  // GRANARY_WHERE_user
+
+// Combine the return address and size order into a single, non-zero key.
+// Canonical addresses repeat their high-order bit, so the shift loses nothing.
+static uint64_t TypeKey(uintptr_t ret_address, size_t size_order) {
+  return (ret_address << 7U) | (size_order << 1U) | 1U;
 }
 
-// Create a new type.
-static const Type *CreateType(TypeList *ls, uint64_t ret_address,
-                              size_t size_order) {
-  // Double check to resolve a race.
-  if (auto type = FindType(ls, ret_address, size_order)) return type;
+// Hash a type key into the type table.
+static uint64_t HashKey(uint64_t key) {
+  return (key * 0x9E3779B97F4A7C15ULL) >> (64 - kTypeTableSizeLog2);
+}
 
+// Returns the type ID used for types of size order `size_order` once we've run
+// out of type IDs.
+static uint64_t OverflowTypeIdFor(size_t size_order) {
+  return kFirstOverflowTypeId + size_order;
+}
+
+// Wait for a type ID to be published into a claimed entry.
+static uint64_t WaitForTypeId(const TypeTableEntry &entry) {
+  for (;;) {
+    if (auto id = entry.id.load(std::memory_order_acquire)) return id - 1;
+    arch::Relax();
+  }
+}
+
+// Assign a type ID to a newly claimed entry.
+static uint64_t AssignTypeId(TypeTableEntry &entry, uintptr_t ret_address,
+                             size_t size_order) {
   auto type_id = gNextTypeId.fetch_add(1);
-  if (kMaxWatchpointTypeId <= type_id) {
-    if (!gNoMoreTypeIds) {
-      gNoMoreTypeIds = true;
-      os::Log(os::LogDebug, "WARNING: Ran out of type IDs.");
+  if (kFirstOverflowTypeId <= type_id) {
+    if (!gNoMoreTypeIds.exchange(true)) {
+      os::Log(os::LogDebug, "WARNING: Ran out of type IDs; new types will "
+                            "only be distinguished by their size.");
+    }
+    type_id = OverflowTypeIdFor(size_order);
+  } else {
+    gTypes[type_id].ret_address = ret_address;
+    gTypes[type_id].size_order = size_order;
+  }
+  entry.id.store(type_id + 1, std::memory_order_release);
+  return type_id;
+}
+
+// Find the type ID of some type, or create a new type ID.
+static uint64_t FindOrCreateTypeId(uint64_t key, uintptr_t ret_address,
+                                   size_t size_order) {
+  auto index = HashKey(key);
+  for (auto i = 0ULL; i < kTypeTableSize; ++i) {
+    auto &entry(gTypeTable[index]);
+    auto entry_key = entry.key.load(std::memory_order_acquire);
+    if (key == entry_key) return WaitForTypeId(entry);
+    if (!entry_key) {
+      if (gNoMoreTypeIds.load(std::memory_order_relaxed)) break;
+      if (entry.key.compare_exchange_strong(entry_key, key)) {
+        return AssignTypeId(entry, ret_address, size_order);
+      } else if (key == entry_key) {  // Lost a race to insert the same type.
+        return WaitForTypeId(entry);
+      }
     }
-    return nullptr;
+    index = (index + 1) & (kTypeTableSize - 1);
   }
-  auto new_type = &(gTypes[type_id]);
-  new_type->ret_address = ret_address;
-  new_type->size_order = size_order;
-  new_type->next = ls->types;
-  ls->types = new_type;
-  return new_type;
+  return OverflowTypeIdFor(size_order);
 }
 
 }  // namespace
@@ -77,32 +139,33 @@ uint64_t TypeIdFor(uintptr_t ret_address, size_t num_bytes) {
   size_t size_order = 0;
   if (num_bytes) {
     size_order = 63UL - static_cast<size_t>(__builtin_clzl(num_bytes));
-    GRANARY_ASSERT(size_order <= kMaxSetBit);
-  }
-  const auto type_list = &(gTypeTable[ret_address % kTypeTableSize]);
-  const Type *type(nullptr);
-  {
-    ReadLockedRegion locker(&(type_list->types_lock));
-    type = FindType(type_list, ret_address, size_order);
-  }
-  if (!type) {
-    WriteLockedRegion locker(&(type_list->types_lock));
-    if (!(type = CreateType(type_list, ret_address, size_order))) {
-      return kMaxWatchpointTypeId;
-    }
   }
-  return IdOf(type);
+  const auto key = TypeKey(ret_address, size_order);
+#ifdef GRANARY_WHERE_user
+  const auto version = gTypeTableVersion.load(std::memory_order_relaxed);
+  auto &cached(tTypeCache[(ret_address ^ size_order) % kThreadCacheSize]);
+  if (cached.key == key && cached.version == version) return cached.id;
+  cached.id = FindOrCreateTypeId(key, ret_address, size_order);
+  cached.key = key;
+  cached.version = version;
+  return cached.id;
+#else
+  return FindOrCreateTypeId(key, ret_address, size_order);
+#endif  // GRANARY_WHERE_user
 }
 
 // Apply a function to every type.
 void ForEachType(std::function<void(uint64_t type_id,
                                     granary::AppPC ret_address,
                                     size_t size_order)> func) {
-  const auto max_id = gNextTypeId.load(std::memory_order_relaxed);
-  auto id = 0ULL;
-  for (const auto &type : gTypes) {
+  auto max_id = gNextTypeId.load(std::memory_order_relaxed);
+  if (gNoMoreTypeIds.load(std::memory_order_relaxed)) {
+    max_id = kMaxWatchpointTypeId;
+  }
+  max_id = GRANARY_MIN(max_id, static_cast<uint64_t>(kMaxWatchpointTypeId));
+  for (auto id = 0ULL; id < max_id; ++id) {
+    const auto &type(gTypes[id]);
     func(id, reinterpret_cast<AppPC>(type.ret_address), type.size_order);
-    if (++id >= max_id) return;
   }
 }
 
@@ -112,8 +175,15 @@ size_t SizeOfType(uint64_t type_id) {
 }
 
 GRANARY_ON_CLIENT_INIT() {
-  gNoMoreTypeIds = false;
+  gNoMoreTypeIds.store(false);
   gNextTypeId.store(0);
   memset(gTypes, 0, sizeof gTypes);
-  memset(gTypeTable, 0, sizeof gTypeTable);
+  for (auto &entry : gTypeTable) {
+    entry.key.store(0, std::memory_order_relaxed);
+    entry.id.store(0, std::memory_order_relaxed);
+  }
+  for (auto size_order = 0ULL; size_order <= kMaxSizeOrder; ++size_order) {
+    gTypes[OverflowTypeIdFor(size_order)].size_order = size_order;
+  }
+  GRANARY_IF_USER( gTypeTableVersion.fetch_add(1); )
 }
@@ -77,4 +77,44 @@ void ReaderWriterLock::WriteRelease(void) {
   lock.store(0, std::memory_order_release);
 }
 
+// Read-side acquire. Readers announce themselves in their counter before
+// checking for a writer; writers announce themselves before checking the
+// counters. Sequentially consistent ordering guarantees that at least one of
+// the two sees the other.
+size_t DistributedReaderWriterLock::ReadAcquire(void) {
+  const auto base = os::ThreadBase();
+  const auto token = ((base >> 12) ^ (base >> 6)) % kNumReaderCounters;
+  auto &counter(readers[token].num_readers);
+  for (;;) {
+    while (has_writer.load(std::memory_order_acquire)) {
+      os::YieldThread();
+    }
+    counter.fetch_add(1, std::memory_order_seq_cst);
+    if (!has_writer.load(std::memory_order_seq_cst)) return token;
+    counter.fetch_sub(1, std::memory_order_release);
+  }
+}
+
+// Read-side release.
+void DistributedReaderWriterLock::ReadRelease(size_t token) {
+  readers[token].num_readers.fetch_sub(1, std::memory_order_release);
+}
+
+// Write-side acquire.
+void DistributedReaderWriterLock::WriteAcquire(void) {
+  while (has_writer.exchange(true, std::memory_order_seq_cst)) {
+    os::YieldThread();
+  }
+  for (auto &counter : readers) {
+    while (counter.num_readers.load(std::memory_order_seq_cst)) {
+      os::YieldThread();
+    }
+  }
+}
+
+// Write-side release.
+void DistributedReaderWriterLock::WriteRelease(void) {
+  has_writer.store(false, std::memory_order_release);
+}
+
 }  // namespace granary
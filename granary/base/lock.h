@@ -3,6 +3,8 @@
 #ifndef GRANARY_BASE_LOCK_H_
 #define GRANARY_BASE_LOCK_H_
 
+#include "arch/base.h"
+
 #include "granary/base/base.h"
 
 namespace granary {
@@ -116,6 +118,62 @@ class WriteLockedRegion {
   GRANARY_DISALLOW_COPY_AND_ASSIGN(WriteLockedRegion);
 };
 
+// Implements a reader/writer lock for read-mostly data, where readers are
+// frequent and writers are rare (e.g. only at exit). Rather than sharing one
+// counter, readers increment one of several cache line-sized counters, chosen
+// by the thread (or CPU) base address, so that readers on different threads
+// rarely contend. Writers pay for this by checking every counter.
+class DistributedReaderWriterLock {
+ public:
+  inline DistributedReaderWriterLock(void)
+      : readers(),
+        has_writer(false) {}
+
+  // Acquire the lock for reading. Returns a token that must be passed to the
+  // corresponding `ReadRelease`.
+  size_t ReadAcquire(void);
+  void ReadRelease(size_t token);
+
+  void WriteAcquire(void);
+  void WriteRelease(void);
+
+ private:
+  enum : size_t {
+    kNumReaderCounters = 16
+  };
+
+  struct alignas(arch::CACHE_LINE_SIZE_BYTES) ReaderCounter {
+    std::atomic<uint64_t> num_readers;
+  };
+
+  ReaderCounter readers[kNumReaderCounters];
+
+  alignas(arch::CACHE_LINE_SIZE_BYTES) std::atomic<bool> has_writer;
+
+  GRANARY_DISALLOW_COPY_AND_ASSIGN(DistributedReaderWriterLock);
+};
+
+// Ensures that a read lock is held within some scope.
+class DistributedReadLockedRegion {
+ public:
+  inline explicit DistributedReadLockedRegion(
+      DistributedReaderWriterLock *lock_)
+      : lock(lock_),
+        token(lock->ReadAcquire()) {}
+
+  inline ~DistributedReadLockedRegion(void) {
+    lock->ReadRelease(token);
+  }
+
+ private:
+  DistributedReadLockedRegion(void) = delete;
+
+  DistributedReaderWriterLock * const lock;
+  const size_t token;
+
+  GRANARY_DISALLOW_COPY_AND_ASSIGN(DistributedReadLockedRegion);
+};
+
 }  // namespace granary
 
 #endif  // GRANARY_BASE_LOCK_H_
@@ -10,6 +10,7 @@
 #include "granary/code/edge.h"
 
 #include "granary/cache.h"
+#include "granary/stats.h"
 
 #include "os/lock.h"
 #include "os/memory.h"
@@ -98,6 +99,9 @@ class CodeCache {
   // Allocate a block of code from this code cache.
   CachePC AllocateCode(size_t size);
 
+  // Allocate a block of code from this code cache that begins at `pc`.
+  CachePC AllocateCodeAt(CachePC pc, size_t size);
+
  private:
   // The size of a slab.
   const size_t slab_num_pages;
@@ -151,6 +155,20 @@ CachePC CodeCache::AllocateCode(size_t size) {
   return addr;
 }
 
+// Allocate a block of code from this code cache that begins at `pc`. This
+// fails if something else has been allocated after `pc`, or if the code
+// wouldn't fit in the current slab.
+CachePC CodeCache::AllocateCodeAt(CachePC pc, size_t size) {
+  SpinLockedRegion locker(&slab_list_lock);
+  auto new_offset = slab_byte_offset + size;
+  if (pc != &(slab_list->begin[slab_byte_offset]) ||
+      new_offset >= slab_num_bytes) {
+    return nullptr;
+  }
+  slab_byte_offset = new_offset;
+  return pc;
+}
+
 // Lock around all code cache transactions.
 static os::Lock gCodeCacheLock;
 
@@ -162,9 +180,26 @@ static Container<CodeCache> gCodeCaches[kNumCodeCacheKinds];
 // Used to allocate code from a code cache.
 CachePC AllocateCode(CodeCacheKind kind, size_t num_bytes) {
   if (!num_bytes) return nullptr;
+  StatTimer timer(kStatTimeAllocateCode);
+  AddStat(kStatNumCodeCacheAllocations, kind, 1);
+  AddStat(kStatNumCodeCacheBytes, kind, num_bytes);
   return gCodeCaches[kind]->AllocateCode(num_bytes);
 }
 
+// Used to allocate code from a code cache, such that the allocated code
+// begins at `pc`. This only succeeds if `pc` is the end of the most recent
+// allocation from the code cache, and returns `nullptr` otherwise.
+CachePC AllocateCodeAt(CodeCacheKind kind, CachePC pc, size_t num_bytes) {
+  if (!num_bytes || !pc) return nullptr;
+  StatTimer timer(kStatTimeAllocateCode);
+  auto code = gCodeCaches[kind]->AllocateCodeAt(pc, num_bytes);
+  if (code) {
+    AddStat(kStatNumCodeCacheAllocations, kind, 1);
+    AddStat(kStatNumCodeCacheBytes, kind, num_bytes);
+  }
+  return code;
+}
+
 // Begin a transaction that will read or write to the code cache.
 //
 // Note: Transactions are distinct from allocations. Therefore, many threads/
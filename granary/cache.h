@@ -44,6 +44,11 @@ enum {
 // Used to allocate code from a code cache.
 CachePC AllocateCode(CodeCacheKind kind, size_t num_bytes);
 
+// Used to allocate code from a code cache, such that the allocated code
+// begins at `pc`. This only succeeds if `pc` is the end of the most recent
+// allocation from the code cache, and returns `nullptr` otherwise.
+CachePC AllocateCodeAt(CodeCacheKind kind, CachePC pc, size_t num_bytes);
+
 // Returns the address of the code that exits the code cache via a direct edge.
 CachePC DirectExitFunction(void);
 
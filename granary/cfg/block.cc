@@ -94,6 +94,7 @@ Block::Block(void)
       id(-1),
       generation(0),
       is_reachable(false),
+      next_indexed(nullptr),
       successors{nullptr, nullptr},
       fragment(nullptr) {}
 
@@ -165,6 +165,9 @@ class Block {
   // Is this block reachable from the entry node of the trace?
   GRANARY_INTERNAL_DEFINITION bool is_reachable;
 
+  // Next block in the same bucket of the trace's block index.
+  GRANARY_INTERNAL_DEFINITION Block *next_indexed;
+
   // Successor blocks.
   Block *successors[2];
 
@@ -17,6 +17,7 @@
 #include "granary/app.h"
 #include "granary/cache.h"
 #include "granary/index.h"
+#include "granary/stats.h"
 #include "granary/util.h"
 
 #include "os/exception.h"
@@ -262,6 +263,8 @@ static void AnnotateInstruction(BlockFactory *factory, DecodedBlock *block,
 // Decode an instruction list starting at `pc` and link the decoded
 // instructions into the instruction list beginning with `instr`.
 void BlockFactory::DecodeInstructionList(DecodedBlock *block) {
+  StatTimer timer(kStatTimeDecode);
+  AddStat(kStatNumDecodedBlocks);
   auto decode_pc = block->StartAppPC();
   arch::InstructionDecoder decoder(block);
   arch::Instruction dinstr;
@@ -292,6 +295,7 @@ void BlockFactory::DecodeInstructionList(DecodedBlock *block) {
     decoder.Mangle(&dinstr);
 
     block->AppendInstruction(MakeInstruction(&dinstr, &ainstr));
+    AddStat(kStatNumDecodedInstructions);
     AnnotateInstruction(this, block, before_instr, decode_pc);
 
     instr = block->LastInstruction()->Previous();
@@ -384,6 +388,7 @@ void BlockFactory::RemoveUnreachableBlocks(void) {
   trace->blocks = old_blocks;
   trace->first_new_block = new_blocks.First();
   trace->blocks.Extend(new_blocks);
+  trace->ReindexBlocks();
 }
 
 // Search an trace for a block whose meta-data matches the meta-data of
@@ -393,14 +398,14 @@ InstrumentedBlock *BlockFactory::MaterializeFromTrace(
     DirectBlock *exclude) {
   InstrumentedBlock *adapt_block(nullptr);
   const auto exclude_meta = exclude->meta;
-  for (auto block : trace->ReverseBlocks()) {
-    if (block == exclude) continue;
-
-    // Allow us to materialize with a block that hasn't been added to the trace
-    // yet but is part of this materialization step.
-    if (auto direct_block = DynamicCast<DirectBlock *>(block)) {
-      block = direct_block->materialized_block;
-    }
+  const auto start_pc = exclude->StartAppPC();
+
+  // Blocks materialized during this step are added to the trace (and so to
+  // the index) as soon as they are materialized, so there's no need to look
+  // through `DirectBlock`s.
+  for (auto block = trace->FindIndexedBlocks(start_pc); block;
+       block = block->next_indexed) {
+    if (block->StartAppPC() != start_pc) continue;
 
     // Only materialize with blocks that should have meta-data.
     auto inst_block = DynamicCast<InstrumentedBlock *>(block);
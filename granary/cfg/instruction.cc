@@ -275,6 +275,40 @@ void NativeInstruction::ForEachOperandImpl(
   instruction.ForEachOperand(func);
 }
 
+// Try to match `mloc`, a memory operand of this instruction, as a base
+// register plus a constant displacement.
+//
+// Note: Early mangling turns an application memory operand like `[RBX + 16]`
+//       into `LEA %vr, [RBX + 16]`, followed by this instruction accessing
+//       `[%vr]`. The `LEA` is placed after the previous application
+//       instruction, so we look back until then for the `LEA` that defines
+//       the virtual register.
+bool NativeInstruction::MatchBaseAndDisplacement(const MemoryOperand &mloc,
+                                                 VirtualRegister &base,
+                                                 intptr_t &disp) {
+  if (!mloc.MatchBaseAndDisplacement(base, disp)) return false;
+  if (!base.IsVirtual()) return true;
+  for (auto instr = Previous(); instr; instr = instr->Previous()) {
+    auto ninstr = DynamicCast<NativeInstruction *>(instr);
+    if (!ninstr) continue;
+    if (ninstr->IsAppInstruction()) break;
+
+    RegisterOperand addr_reg;
+    MemoryOperand addr;
+    if (!ninstr->MatchOperands(WriteOnlyTo(addr_reg), ReadOrWriteTo(addr)) ||
+        !addr.IsEffectiveAddress() || addr_reg.Register() != base) {
+      continue;
+    }
+    VirtualRegister addr_base;
+    intptr_t addr_disp(0);
+    if (!addr.MatchBaseAndDisplacement(addr_base, addr_disp)) return false;
+    base = addr_base;
+    disp += addr_disp;
+    return true;
+  }
+  return true;
+}
+
 // Try to match and bind one or more operands from this instruction. Returns
 // the number of operands matched, starting from the first operand.
 size_t NativeInstruction::CountMatchedOperandsImpl(
@@ -389,6 +389,15 @@ class NativeInstruction : public Instruction {
   // Returns the names of the instruction prefixes on this instruction.
   const char *PrefixNames(void) const;
 
+  // Try to match `mloc`, a memory operand of this instruction, as a base
+  // register plus a constant displacement. Unlike
+  // `MemoryOperand::MatchBaseAndDisplacement`, this also matches displaced
+  // memory operands that early mangling replaced with a dereference of a
+  // virtual register, e.g. `[RBX + 16]` is matched as `RBX` and `16`, rather
+  // than as some virtual register and `0`.
+  bool MatchBaseAndDisplacement(const MemoryOperand &mloc,
+                                VirtualRegister &base, intptr_t &disp);
+
   // Try to match and bind one or more operands from this instruction.
   //
   // Note: Matches are attempted in order!
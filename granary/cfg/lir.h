@@ -154,6 +154,15 @@ inline static std::unique_ptr<Instruction> InlineFunctionCall(
 //            code.
 
 // Represents a block of inline assembly.
+//
+// Note: Constant operands are specialized when the inline assembly is
+//       compiled. An input `ImmediateOperand` holding an address can be
+//       dereferenced directly, e.g. `INC m64 [%0 + 8];` or `INC m64 %0;`,
+//       which becomes a `RIP`-relative or `disp32` memory operand where
+//       possible. Within one block of inline assembly, a register variable
+//       assigned a constant by `MOV r64 %1, i64 %0;` is replaced by that
+//       constant in later memory operands (`[%1]`) and, if it fits in 32
+//       bits, in later source operands (`MOV m64 [%2], r64 %1;`).
 class InlineAssembly {
  public:
   inline InlineAssembly(void)
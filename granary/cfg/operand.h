@@ -207,6 +207,21 @@ class MemoryOperand : public Operand {
   // Note: This has a architecture-specific implementation.
   bool MatchSegmentRegister(VirtualRegister &reg) const;
 
+  // Try to match this memory operand as a base register plus a constant
+  // displacement, e.g. `[RBX + 16]`. Non-compound register memory operands are
+  // matched with a displacement of `0`.
+  //
+  // Note: This does not match segment-relative memory operands.
+  //
+  // Note: This only looks at this operand, so an application memory operand
+  //       that was replaced by early mangling is matched as its address
+  //       register with a displacement of `0`. Use
+  //       `NativeInstruction::MatchBaseAndDisplacement` to match the original
+  //       base and displacement.
+  //
+  // Note: This has a architecture-specific implementation.
+  bool MatchBaseAndDisplacement(VirtualRegister &base, intptr_t &disp) const;
+
   // Try to match several registers from the memory operand. This is applicable
   // when this is a compound memory operand, e.g. `base + index * scale`. This
   // also works when the memory operand is not compound.
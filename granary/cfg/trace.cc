@@ -13,6 +13,8 @@
 #include "granary/context.h"
 #include "granary/breakpoint.h"
 
+#include "os/memory.h"
+
 namespace granary {
 
 Trace::Trace(Context *context_)
@@ -20,6 +22,11 @@ Trace::Trace(Context *context_)
       entry_block(nullptr),
       blocks(),
       first_new_block(nullptr),
+      block_index(&(inline_block_index[0])),
+      num_block_index_buckets(kNumInlineBlockIndexBuckets),
+      num_block_index_pages(0),
+      num_indexed_blocks(0),
+      inline_block_index{nullptr},
       num_temporary_regs(kMinTemporaryVirtualRegister),
       num_virtual_regs(kMinTraceVirtualRegister),
       num_basic_blocks(0),
@@ -31,6 +38,9 @@ Trace::~Trace(void) {
     next = block->list.Next();
     delete block;
   }
+  if (num_block_index_pages) {
+    os::FreeDataPages(block_index, num_block_index_pages);
+  }
 }
 
 // Return the entry basic block of this control-flow graph.
@@ -53,23 +63,195 @@ BlockIterator Trace::NewBlocks(void) const {
   return BlockIterator(first_new_block);
 }
 
+// Returns true if the last materialization step added any new blocks to the
+// trace, i.e. if `NewBlocks` is non-empty.
+bool Trace::HasNewBlocks(void) const {
+  return nullptr != first_new_block;
+}
+
+namespace {
+
+// Returns the bucket of the block index for some starting PC.
+static size_t BlockIndexBucket(AppPC start_pc, size_t num_buckets) {
+  auto addr = reinterpret_cast<uintptr_t>(start_pc);
+  return ((addr >> 4) ^ (addr >> 12)) % num_buckets;
+}
+
+// Returns true if `block` belongs in the block index. Direct blocks are not
+// indexed, as they are never materialized to other direct blocks.
+static bool IsIndexable(const Block *block) {
+  return IsA<const InstrumentedBlock *>(block) &&
+         !IsA<const DirectBlock *>(block);
+}
+
+// Stack of blocks whose successors are being added to a trace, along with
+// the next successor of each block to visit.
+class AddBlockStack {
+ public:
+  AddBlockStack(void)
+      : frames(reinterpret_cast<Frame *>(&(inline_frames[0]))),
+        num_frames(0),
+        max_num_frames(kNumInlineFrames),
+        num_pages(0) {}
+
+  ~AddBlockStack(void) {
+    if (num_pages) os::FreeDataPages(frames, num_pages);
+  }
+
+  inline bool IsEmpty(void) const {
+    return !num_frames;
+  }
+
+  void Push(Block *block) {
+    if (GRANARY_UNLIKELY(num_frames == max_num_frames)) Grow();
+    new (&(frames[num_frames++])) Frame{block, block->Successors()};
+  }
+
+  inline void Pop(void) {
+    --num_frames;
+  }
+
+  // Returns the next successor of the block on the top of the stack, or
+  // `nullptr` if all of its successors have been visited.
+  Block *NextSuccessor(void) {
+    auto &frame(frames[num_frames - 1]);
+    if (!(frame.succ != frame.succ.end())) return nullptr;
+    auto succ = (*frame.succ).block;
+    ++frame.succ;
+    return succ;
+  }
+
+ private:
+  struct Frame {
+    Block *block;
+    detail::SuccessorBlockIterator succ;
+  };
+
+  enum : size_t {
+    kNumInlineFrames = 32
+  };
+
+  // Double the maximum depth of the stack.
+  void Grow(void) {
+    auto new_num_pages = GRANARY_ALIGN_TO(2 * max_num_frames * sizeof(Frame),
+                                          arch::PAGE_SIZE_BYTES) /
+                         arch::PAGE_SIZE_BYTES;
+    auto new_frames = reinterpret_cast<Frame *>(
+        os::AllocateDataPages(new_num_pages));
+    memcpy(new_frames, frames, num_frames * sizeof(Frame));
+    if (num_pages) os::FreeDataPages(frames, num_pages);
+    frames = new_frames;
+    num_pages = new_num_pages;
+    max_num_frames = (num_pages * arch::PAGE_SIZE_BYTES) / sizeof(Frame);
+  }
+
+  Frame *frames;
+  size_t num_frames;
+  size_t max_num_frames;
+  size_t num_pages;
+  alignas(Frame) uint8_t inline_frames[kNumInlineFrames * sizeof(Frame)];
+
+  GRANARY_DISALLOW_COPY_AND_ASSIGN(AddBlockStack);
+};
+
+}  // namespace
+
 // Add a block to the CFG. If the block has successors that haven't yet been
 // added, then add those too.
+//
+// Note: Blocks are added in the same depth-first order as a recursive walk
+//       of the successors would add them, so that block IDs and the layout
+//       of the block list are unchanged. An explicit stack is used instead of
+//       recursion because large traces can otherwise overflow Granary's
+//       (small) private stacks.
 void Trace::AddBlock(Block *block) {
   if (block->list.IsLinked()) {
     GRANARY_ASSERT(-1 != block->Id());
-  } else {
-    // We might already have a block id if this block inherits the id of the
-    // `DirectBlock` that led to its materialization.
-    if (-1 == block->id) block->id = num_basic_blocks++;
-
-    // Distinguishes old from new blocks across iterations of
-    // `InstrumentControlFlow`.
-    block->generation = generation;
-    blocks.Append(block);
-    for (auto succ : block->Successors()) {  // Add the successors.
-      AddBlock(succ.block);
+    return;
+  }
+  AddBlockStack stack;
+  LinkBlock(block);
+  stack.Push(block);
+  while (!stack.IsEmpty()) {
+    if (auto succ = stack.NextSuccessor()) {
+      if (!succ->list.IsLinked()) {  // Add the successor.
+        LinkBlock(succ);
+        stack.Push(succ);
+      }
+    } else {
+      stack.Pop();
+    }
+  }
+}
+
+// Assign an ID and generation to a block, and add it to the block list and
+// index.
+void Trace::LinkBlock(Block *block) {
+  // We might already have a block id if this block inherits the id of the
+  // `DirectBlock` that led to its materialization.
+  if (-1 == block->id) block->id = num_basic_blocks++;
+
+  // Distinguishes old from new blocks across iterations of
+  // `InstrumentControlFlow`.
+  block->generation = generation;
+
+  // Grow the index before it gets too crowded. On average, there are at most
+  // two blocks per bucket.
+  if (IsIndexable(block) &&
+      num_indexed_blocks >= 2 * num_block_index_buckets) {
+    ReindexBlocks();
+  }
+  blocks.Append(block);
+  IndexBlock(block);
+}
+
+// Add a block to the index of blocks by their starting PCs.
+void Trace::IndexBlock(Block *block) {
+  if (!IsIndexable(block)) return;
+  auto &bucket(block_index[BlockIndexBucket(block->StartAppPC(),
+                                            num_block_index_buckets)]);
+  block->next_indexed = bucket;
+  bucket = block;
+  ++num_indexed_blocks;
+}
+
+// Empty the block index, and make sure that it has enough buckets for
+// `num_blocks` blocks.
+void Trace::ResizeBlockIndex(size_t num_blocks) {
+  auto num_buckets = num_block_index_buckets;
+  while (num_buckets < num_blocks) num_buckets *= 2;
+  if (num_buckets != num_block_index_buckets) {
+    if (num_block_index_pages) {
+      os::FreeDataPages(block_index, num_block_index_pages);
     }
+    num_block_index_pages = GRANARY_ALIGN_TO(num_buckets * sizeof(Block *),
+                                             arch::PAGE_SIZE_BYTES) /
+                            arch::PAGE_SIZE_BYTES;
+    block_index = reinterpret_cast<Block **>(
+        os::AllocateDataPages(num_block_index_pages));
+    num_block_index_buckets = num_buckets;
+  }
+  memset(block_index, 0, num_block_index_buckets * sizeof(Block *));
+  num_indexed_blocks = 0;
+}
+
+// Returns the most recently added block that might begin at `start_pc`.
+// Other candidates are found by following `Block::next_indexed`.
+Block *Trace::FindIndexedBlocks(AppPC start_pc) const {
+  return block_index[BlockIndexBucket(start_pc, num_block_index_buckets)];
+}
+
+// Re-build the block index after blocks are added to or removed from the
+// trace.
+void Trace::ReindexBlocks(void) {
+  auto num_blocks = 0UL;
+  for (auto block : Blocks()) {
+    if (IsIndexable(block)) ++num_blocks;
+  }
+  ResizeBlockIndex(num_blocks);
+  for (auto block : Blocks()) {
+    block->next_indexed = nullptr;
+    IndexBlock(block);
   }
 }
 
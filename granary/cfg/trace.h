@@ -62,11 +62,23 @@ class Trace final {
   // blocks, and `NewBlocks` is the list of newly materialized basic blocks.
   BlockIterator NewBlocks(void) const;
 
+  // Returns true if the last materialization step added any new blocks to the
+  // trace, i.e. if `NewBlocks` is non-empty.
+  bool HasNewBlocks(void) const;
+
   // Add a block to the CFG. If the block has successors that haven't yet been
   // added, then add those too.
   GRANARY_INTERNAL_DEFINITION void AddBlock(Block *block);
   GRANARY_INTERNAL_DEFINITION void AddEntryBlock(Block *block);
 
+  // Returns the most recently added block that might begin at `start_pc`.
+  // Other candidates are found by following `Block::next_indexed`.
+  GRANARY_INTERNAL_DEFINITION Block *FindIndexedBlocks(AppPC start_pc) const;
+
+  // Re-build the block index after blocks are added to or removed from the
+  // trace.
+  GRANARY_INTERNAL_DEFINITION void ReindexBlocks(void);
+
   // Allocate a new virtual register for this trace.
   VirtualRegister AllocateVirtualRegister(
       size_t num_bytes=arch::GPR_WIDTH_BYTES);
@@ -85,6 +97,17 @@ class Trace final {
 
   Trace(void) = delete;
 
+  // Assign an ID and generation to a block, and add it to the block list and
+  // index.
+  GRANARY_INTERNAL_DEFINITION void LinkBlock(Block *block);
+
+  // Add a block to the index of blocks by their starting PCs.
+  GRANARY_INTERNAL_DEFINITION void IndexBlock(Block *block);
+
+  // Empty the block index, and make sure that it has enough buckets for
+  // `num_blocks` blocks.
+  GRANARY_INTERNAL_DEFINITION void ResizeBlockIndex(size_t num_blocks);
+
   // Context to which this trace belongs. This is needed so that we can allocate
   // edge code data structures.
   GRANARY_INTERNAL_DEFINITION Context *context;
@@ -94,6 +117,22 @@ class Trace final {
   GRANARY_INTERNAL_DEFINITION ListOfListHead<Block> blocks;
   GRANARY_INTERNAL_DEFINITION Block *first_new_block;
 
+  // Index of instrumented blocks, hashed by their starting PCs. This is used
+  // to find existing blocks to which direct blocks can be materialized
+  // without scanning the whole trace.
+  //
+  // Note: The index starts out using `inline_block_index`, and is moved into
+  //       page-allocated memory, with more buckets, as the trace grows.
+  enum : size_t {
+    kNumInlineBlockIndexBuckets = 32
+  };
+  GRANARY_INTERNAL_DEFINITION Block **block_index;
+  GRANARY_INTERNAL_DEFINITION size_t num_block_index_buckets;
+  GRANARY_INTERNAL_DEFINITION size_t num_block_index_pages;
+  GRANARY_INTERNAL_DEFINITION size_t num_indexed_blocks;
+  GRANARY_INTERNAL_DEFINITION
+  Block *inline_block_index[kNumInlineBlockIndexBuckets];
+
   // Counter of how many virtual registers were allocated within this trace.
   //
   // We default this to a fairly large number so that virtual register numbers
@@ -9,6 +9,7 @@
 
 // Stages of assembly.
 #include "granary/code/assemble/0_compile_inline_assembly.h"
+#include "granary/code/assemble/0_optimize_instrumentation.h"
 #include "granary/code/assemble/1_late_mangle.h"
 #include "granary/code/assemble/2_build_fragment_list.h"
 #include "granary/code/assemble/3_partition_fragments.h"
@@ -20,7 +21,9 @@
 #include "granary/code/assemble/9_allocate_slots.h"
 #include "granary/code/assemble/10_add_connecting_jumps.h"
 #include "granary/code/assemble/11_find_block_entrypoints.h"
+#include "granary/code/assemble/12_peephole_optimize.h"
 
+#include "granary/stats.h"
 #include "granary/util.h"
 
 GRANARY_DEFINE_bool(debug_log_fragments, false,
@@ -30,6 +33,13 @@ GRANARY_DEFINE_bool(debug_log_fragments, false,
 GRANARY_DEFINE_uint(num_copy_propagations, 2,
     "The number of iterations of copy propagation to run. The default is `2`.");
 
+// Time a stage of assembly.
+#define TIME_STAGE(timer, ...) \
+  do { \
+    StatTimer stage_timer(timer); \
+    __VA_ARGS__; \
+  } while (0)
+
 namespace granary {
 
 // Assemble the local control-flow graph.
@@ -37,12 +47,16 @@ FragmentList Assemble(Context *context, Trace *cfg) {
 
   // Compile all inline assembly instructions by parsing the inline assembly
   // instructions and doing code generation for them.
-  CompileInlineAssembly(cfg);
+  TIME_STAGE(kStatTimeCompileInlineAssembly, CompileInlineAssembly(cfg));
+
+  // Remove redundant computations and checks from the compiled inline assembly
+  // of independent instrumentation of nearby instructions.
+  TIME_STAGE(kStatTimeOptimizeInstrumentation, OptimizeInstrumentation(cfg));
 
   // "Fix" instructions that might use PC-relative operands that are now too
   // far away from their original data/targets (e.g. if the code cache is really
   // far away from the original native code in memory).
-  MangleInstructions(cfg);
+  TIME_STAGE(kStatTimeMangleInstructions, MangleInstructions(cfg));
 
   FragmentList frags;
 
@@ -52,45 +66,54 @@ FragmentList Assemble(Context *context, Trace *cfg) {
   // can contain internal control-flow. This makes further analysis more
   // complicated, so to simplify things we re-split up the blocks into fragments
   // that represent the "true" basic blocks.
-  BuildFragmentList(context, cfg, &frags);
+  TIME_STAGE(kStatTimeBuildFragmentList,
+             BuildFragmentList(context, cfg, &frags));
 
   // Try to figure out the stack frame size on entry to / exit from every
   // fragment.
-  PartitionFragments(&frags);
+  TIME_STAGE(kStatTimePartitionFragments, PartitionFragments(&frags));
 
   // Add a bunch of entry/exit fragments at places where flags needs to be
   // saved/restored, and at places where GPRs need to be spilled / filled.
-  AddEntryAndExitFragments(&frags);
+  TIME_STAGE(kStatTimeAddEntryAndExitFragments,
+             AddEntryAndExitFragments(&frags));
 
   // Add flags saving and restoring code around injected instrumentation
   // instructions.
-  SaveAndRestoreFlags(&frags);
+  TIME_STAGE(kStatTimeSaveAndRestoreFlags, SaveAndRestoreFlags(&frags));
 
   // Figure out the live VRs on entry/exit from each frag.
-  TrackVirtualRegs(&frags);
+  TIME_STAGE(kStatTimeTrackVirtualRegs, TrackVirtualRegs(&frags));
 
   // Perform a single step of copy propagation. The purpose of this is to
   // allow us to get rid of redundant defs/uses of registers that are created
   // by earlier steps.
-  for (auto i = 0U; i < FLAG_num_copy_propagations; ++i) {
-    if (!PropagateRegisterCopies(&frags)) break;
-  }
+  TIME_STAGE(kStatTimePropagateRegisterCopies,
+    for (auto i = 0U; i < FLAG_num_copy_propagations; ++i) {
+      if (!PropagateRegisterCopies(&frags)) break;
+    });
 
   // Schedule the virtual registers into either physical registers or memory
   // locations.
-  ScheduleRegisters(&frags);
+  TIME_STAGE(kStatTimeScheduleRegisters, ScheduleRegisters(&frags));
 
   // Allocate space for the virtual registers, and perform final mangling of
   // instructions so that all abstract spill slots are converted into concrete
   // spill slots.
-  AllocateSlots(&frags);
+  TIME_STAGE(kStatTimeAllocateSlots, AllocateSlots(&frags));
 
   // Add final connecting jumps (where needed) between predecessor and
   // successor fragments.
-  AddConnectingJumps(&frags);
+  TIME_STAGE(kStatTimeAddConnectingJumps, AddConnectingJumps(&frags));
 
   // Identify fragments associated with block entrypoints.
-  FindBlockEntrypointFragments(&frags);
+  TIME_STAGE(kStatTimeFindBlockEntrypointFragments,
+             FindBlockEntrypointFragments(&frags));
+
+  // Remove redundant spills/fills, self-moves, and jumps that the previous
+  // stages left behind. This is the last stage before encoding, as it depends
+  // on registers and slots being allocated, and fragments being ordered.
+  TIME_STAGE(kStatTimePeepholeOptimize, PeepholeOptimize(&frags));
 
   if (FLAG_debug_log_fragments) {
     os::Log(os::LogDebug, &frags);
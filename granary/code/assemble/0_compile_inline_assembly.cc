@@ -2,6 +2,8 @@
 
 #define GRANARY_INTERNAL
 
+#include "granary/base/option.h"
+
 #include "granary/cfg/trace.h"
 #include "granary/cfg/block.h"
 #include "granary/cfg/instruction.h"
@@ -10,6 +12,14 @@
 
 #include "granary/code/assemble/0_compile_inline_assembly.h"
 
+GRANARY_DEFINE_bool(specialize_inline_assembly, true,
+    "Should Granary specialize inline assembly operands that are known to be "
+    "constant? If enabled, then a register variable that is assigned a "
+    "constant (e.g. `MOV r64 %1, i64 %0`) is replaced by the constant where "
+    "it is later used as a source operand that fits in a 32-bit immediate, "
+    "or as a memory address (e.g. `[%1]`), and the assignment is removed if "
+    "the register variable is otherwise unused. The default is `yes`.");
+
 namespace granary {
 namespace arch {
 
@@ -23,6 +33,13 @@ extern void CompileInlineAssemblyBlock(Trace *cfg,
                                        DecodedBlock *block,
                                        granary::Instruction *instr,
                                        InlineAssemblyBlock *asm_block);
+
+// Remove `MOV`s of constants into virtual registers, where the virtual
+// registers are never used.
+//
+// Note: This has an architecture-specific implementation.
+extern void RemoveUnusedConstants(Trace *cfg);
+
 }  // namespace arch
 namespace {
 
@@ -59,6 +76,7 @@ void CompileInlineAssembly(Trace *cfg) {
       CompileInlineAssembly(cfg, decoded_block);
     }
   }
+  if (FLAG_specialize_inline_assembly) arch::RemoveUnusedConstants(cfg);
 }
 
 }  // namespace granary
@@ -0,0 +1,64 @@
+/* Copyright 2014 Peter Goodman, all rights reserved. */
+
+#define GRANARY_INTERNAL
+
+#include "granary/base/option.h"
+
+#include "granary/cfg/trace.h"
+#include "granary/cfg/block.h"
+
+#include "granary/code/assemble/0_optimize_instrumentation.h"
+
+GRANARY_DEFINE_bool(optimize_instrumentation, true,
+    "Should Granary eliminate redundant instrumentation instructions? If "
+    "enabled, then the compiled inline assembly of each block is value "
+    "numbered, which removes repeated computations (e.g. of shadow memory "
+    "addresses) and repeated condition checks (e.g. of tainted address bits) "
+    "that are injected by independent instrumentation of nearby memory "
+    "operands. The default is `yes`.");
+
+GRANARY_DEFINE_bool(fold_address_computations, true,
+    "Should Granary fold address computations back into the memory operands "
+    "that use them? Early mangling splits compound memory operands into an "
+    "`LEA` and a dereference of a virtual register so that tools can operate "
+    "on addresses. If enabled, then these are re-combined in blocks where no "
+    "tool used the address, which saves an instruction and a virtual "
+    "register. The default is `yes`.");
+
+namespace granary {
+namespace arch {
+
+// Eliminate redundant instrumentation instructions from `block` by value
+// numbering the instructions of the block.
+//
+// Note: This has an architecture-specific implementation.
+extern void EliminateRedundantInstructions(DecodedBlock *block);
+
+// Fold `LEA`s of compound addresses into virtual registers back into the
+// memory operands that use them, if nothing else uses the computed address.
+//
+// Note: This has an architecture-specific implementation.
+extern void FoldAddressComputations(DecodedBlock *block);
+
+}  // namespace arch
+
+// Eliminate redundant instrumentation instructions (e.g. repeated address
+// computations or condition checks) from the blocks of a trace. This operates
+// on the compiled inline assembly of all instrumentation tools.
+void OptimizeInstrumentation(Trace *cfg) {
+  if (!FLAG_optimize_instrumentation && !FLAG_fold_address_computations) {
+    return;
+  }
+  for (auto block : cfg->Blocks()) {
+    if (auto decoded_block = DynamicCast<DecodedBlock *>(block)) {
+      if (FLAG_optimize_instrumentation) {
+        arch::EliminateRedundantInstructions(decoded_block);
+      }
+      if (FLAG_fold_address_computations) {
+        arch::FoldAddressComputations(decoded_block);
+      }
+    }
+  }
+}
+
+}  // namespace granary
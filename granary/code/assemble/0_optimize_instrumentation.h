@@ -0,0 +1,22 @@
+/* Copyright 2014 Peter Goodman, all rights reserved. */
+
+#ifndef GRANARY_CODE_ASSEMBLE_0_OPTIMIZE_INSTRUMENTATION_H_
+#define GRANARY_CODE_ASSEMBLE_0_OPTIMIZE_INSTRUMENTATION_H_
+
+#ifndef GRANARY_INTERNAL
+# error "This code is internal to Granary."
+#endif
+
+namespace granary {
+
+// Forward declaration.
+class Trace;
+
+// Eliminate redundant instrumentation instructions (e.g. repeated address
+// computations or condition checks) from the blocks of a trace. This operates
+// on the compiled inline assembly of all instrumentation tools.
+void OptimizeInstrumentation(Trace *cfg);
+
+}  // namespace granary
+
+#endif  // GRANARY_CODE_ASSEMBLE_0_OPTIMIZE_INSTRUMENTATION_H_
@@ -0,0 +1,91 @@
+/* Copyright 2015 Peter Goodman, all rights reserved. */
+
+#define GRANARY_INTERNAL
+#define GRANARY_ARCH_INTERNAL
+
+#include "granary/base/option.h"
+
+#include "granary/cfg/instruction.h"
+
+#include "granary/code/fragment.h"
+
+#include "granary/code/assemble/12_peephole_optimize.h"
+
+#include "granary/stats.h"
+
+GRANARY_DEFINE_bool(peephole_optimize, true,
+    "Should Granary remove redundant instructions (e.g. spills immediately "
+    "followed by fills of the same slot, and jumps to the next fragment) just "
+    "before encoding code into the code cache? The default is `yes`.");
+
+namespace granary {
+namespace arch {
+
+// Removes redundant instructions from the fragment `frag`. Returns the number
+// of instructions that will no longer be encoded.
+//
+// Note: This function has an architecture-specific implementation.
+extern size_t PeepholeOptimize(Fragment *frag);
+
+}  // namespace arch
+namespace {
+
+// Returns true if nothing in `frag` will be encoded.
+static bool IsEmptyFragment(Fragment *frag) {
+  for (auto instr : InstructionListIterator(frag->instrs)) {
+    if (auto ninstr = DynamicCast<NativeInstruction *>(instr)) {
+      if (ninstr->instruction.WillBeEncoded() && !ninstr->IsNoOp()) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Removes the fall-through jump of `frag` if the only fragments between it and
+// its fall-through target are empty. This happens when the fragment that
+// `AddConnectingJumps` placed after `frag` was emptied, e.g. a flags or
+// virtual register entry/exit fragment that turned out not to need any code.
+static bool RemoveFallThroughJump(Fragment *frag) {
+  auto jmp = frag->fall_through_instr;
+  auto succ = frag->successors[kFragSuccFallThrough];
+  if (!jmp || !succ || !jmp->instruction.WillBeEncoded()) return false;
+  if (!jmp->IsUnconditionalJump() || jmp->HasIndirectTarget()) return false;
+
+  // Direct edges need the location of their jump to be patched later.
+  if (succ->encoded_pc || IsA<ExitFragment *>(succ)) return false;
+  if (frag->cache != succ->cache) return false;
+
+  for (auto next = frag->next; next; next = next->next) {
+    if (next == succ) {
+      jmp->instruction.DontEncode();
+      return true;
+    }
+    if (next->encoded_pc || next->cache != frag->cache ||
+        !IsEmptyFragment(next)) {
+      return false;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+// Removes redundant instructions that are left behind by virtual register
+// scheduling, slot allocation, and the addition of connecting jumps. Returns
+// the number of instructions that will no longer be encoded.
+size_t PeepholeOptimize(FragmentList *frags) {
+  if (!FLAG_peephole_optimize) return 0;
+  auto num_removed = 0UL;
+  auto first = frags->First();
+  for (auto frag : EncodeOrderedFragmentIterator(first)) {
+    if (!frag->encoded_pc) num_removed += arch::PeepholeOptimize(frag);
+  }
+  for (auto frag : EncodeOrderedFragmentIterator(first)) {
+    if (RemoveFallThroughJump(frag)) ++num_removed;
+  }
+  AddStat(kStatNumPeepholeRemovedInstructions, num_removed);
+  return num_removed;
+}
+
+}  // namespace granary
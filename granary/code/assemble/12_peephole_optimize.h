@@ -0,0 +1,19 @@
+/* Copyright 2015 Peter Goodman, all rights reserved. */
+
+#ifndef GRANARY_CODE_ASSEMBLE_12_PEEPHOLE_OPTIMIZE_H_
+#define GRANARY_CODE_ASSEMBLE_12_PEEPHOLE_OPTIMIZE_H_
+
+#ifndef GRANARY_INTERNAL
+# error "This code is internal to Granary."
+#endif
+
+namespace granary {
+
+// Removes redundant instructions that are left behind by virtual register
+// scheduling, slot allocation, and the addition of connecting jumps. Returns
+// the number of instructions that will no longer be encoded.
+size_t PeepholeOptimize(FragmentList *frags);
+
+}  // namespace granary
+
+#endif  // GRANARY_CODE_ASSEMBLE_12_PEEPHOLE_OPTIMIZE_H_
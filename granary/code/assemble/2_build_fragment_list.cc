@@ -129,6 +129,10 @@ struct FragmentBuilder {
   FragmentList *frags;
   Trace *cfg;
   Context *context;
+
+  // First direct edge allocated for this trace. All direct edges of the trace
+  // are linked into a ring through `DirectEdge::next_sibling`.
+  DirectEdge *first_edge;
 };
 
 // Enqueue a new fragment to be created to the work list. This fragment
@@ -607,6 +611,12 @@ static void AddDirectBlockToFragList(FragmentBuilder *builder,
                                      DirectBlock *block) {
   auto meta = block->MetaData();
   auto edge = builder->context->AllocateDirectEdge(meta);
+  if (auto first_edge = builder->first_edge) {
+    edge->next_sibling = first_edge->next_sibling;
+    first_edge->next_sibling = edge;
+  } else {
+    builder->first_edge = edge;
+  }
   auto frag = arch::GenerateDirectEdgeCode(edge);
   block->fragment = frag;
   builder->frags->Append(frag);  // To tail of fragment list.
@@ -682,7 +692,8 @@ void BuildFragmentList(Context *context, Trace *cfg,
     nullptr,
     frags,
     cfg,
-    context
+    context,
+    nullptr
   };
   InitializeFragAndWorklist(&builder);
   while (auto item = builder.next) {
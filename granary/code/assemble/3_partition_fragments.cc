@@ -21,14 +21,55 @@ GRANARY_DEFINE_bool(try_spill_VRs_to_stack, GRANARY_IF_TEST_ELSE(false, true),
     "\n"
     "Note: Disabling this is a good way to test if stack spilling/filling is\n"
     "      the cause of a bug.");
+
+GRANARY_DEFINE_bool(try_spill_VRs_to_stack_per_partition, true,
+    "Should Granary decide whether or not to spill virtual registers onto the "
+    "call stack on a per-partition basis? If not, then a single fragment "
+    "with an invalid stack pointer forces every partition in the trace to "
+    "spill virtual registers to thread-local slots. This option is only "
+    "meaningful if `--try_spill_VRs_to_stack` is enabled. The default is "
+    "`yes`.");
 #endif  // GRANARY_WHERE_user
 
 namespace granary {
 namespace {
 
+// Propagate stack invalidity forward to every fragment reachable from a
+// fragment with an invalid stack pointer. For example, after a `MOV RSP, X`,
+// we don't know that the stack is valid again until we leave the trace, so
+// the successors of the fragment containing the `MOV` must also be treated
+// as having an invalid stack.
+static void PropagateStackInvalidity(FragmentList *frags) {
+  for (auto changed = true; changed; ) {
+    changed = false;
+    for (auto frag : FragmentListIterator(frags)) {
+      if (kStackStatusInvalid != frag->stack_status) continue;
+      for (auto succ : frag->successors) {
+        if (succ && kStackStatusInvalid != succ->stack_status) {
+          succ->stack_status = kStackStatusInvalid;
+          changed = true;
+        }
+      }
+    }
+  }
+}
+
 // Initializes the stack validity analysis.
+//
+// Note: In user space, fragments with an invalid stack, and the fragments
+//       that follow them, only disable stack-based spilling within their own
+//       partitions (see `InitStackFrameAnalysis` in `9_allocate_slots.cc`),
+//       unless we're asked to be conservative. In kernel space, a single
+//       fragment with an invalid stack disables stack-based spilling for the
+//       whole trace, as partitions with an invalid stack must also disable
+//       interrupts.
 static void InitStackValidity(FragmentList *frags) {
   auto valid = GRANARY_IF_USER_ELSE(FLAG_try_spill_VRs_to_stack, true);
+  if (valid && GRANARY_IF_USER_ELSE(
+        FLAG_try_spill_VRs_to_stack_per_partition, false)) {
+    PropagateStackInvalidity(frags);
+    return;
+  }
   for (auto frag : FragmentListIterator(frags)) {
     if (kStackStatusInvalid == frag->stack_status) {
       valid = false;
@@ -3,13 +3,26 @@
 #define GRANARY_INTERNAL
 #define GRANARY_ARCH_INTERNAL
 
+#include "granary/base/option.h"
+
 #include "granary/cfg/instruction.h"
 
 #include "granary/code/fragment.h"
 #include "granary/code/assemble/4_add_entry_exit_fragments.h"
 
+#include "granary/app.h"
 #include "granary/util.h"
 
+GRANARY_DEFINE_bool(assume_abi_dead_flags, true,
+    "Should Granary assume that the arithmetic flags are dead across function "
+    "call and return boundaries? The ABI does not require flags to be "
+    "preserved across these boundaries, so instrumentation placed near calls "
+    "and returns does not need to save and restore the flags. The default is "
+    "`yes`.\n"
+    "\n"
+    "Note: Disabling this is a good way to test if some hand-written assembly\n"
+    "      passes information to/from a function through the flags.");
+
 namespace granary {
 namespace arch {
 
@@ -25,6 +38,19 @@ extern void VisitInstructionFlags(const arch::Instruction &instr,
 // Note: This has an architecture-specific implementation.
 extern uint32_t AllArithmeticFlags(void);
 
+// Returns a bitmap representing the arithmetic flags that are live on entry
+// to the application instruction located at `pc`.
+//
+// Note: This has an architecture-specific implementation.
+extern uint32_t AppEntryLiveFlags(AppPC pc);
+
+// Try to convert an instrumentation instruction that writes to the flags into
+// an equivalent instruction that does not write to the flags. Returns `true`
+// if the instruction was converted.
+//
+// Note: This has an architecture-specific implementation.
+extern bool TryConvertToFlagFreeInstruction(Instruction *instr);
+
 }  // namespace arch
 namespace {
 
@@ -79,9 +105,7 @@ struct LiveFlags {
 };
 
 static LiveFlags LiveFlagsOnEntry(Fragment *frag) {
-  if (IsA<ExitFragment *>(frag)) {
-    return LiveFlags(arch::AllArithmeticFlags(), 0);
-  } else if (frag) {
+  if (frag) {
     return LiveFlags(frag->app_flags.entry_live_flags,
                      frag->inst_flags.entry_live_flags);
   } else {
@@ -91,10 +115,17 @@ static LiveFlags LiveFlagsOnEntry(Fragment *frag) {
 
 static LiveFlags LiveFlagsOnExit(Fragment *frag) {
   if (IsA<ExitFragment *>(frag)) {
-    return LiveFlags(arch::AllArithmeticFlags(), 0);
+    return LiveFlags(frag->app_flags.exit_live_flags, 0);
   } else if (frag->branch_instr) {
     if (!frag->branch_instr->IsConditionalJump()) {
-      return LiveFlagsOnEntry(frag->successors[kFragSuccBranch]);
+      auto branch_live = LiveFlagsOnEntry(frag->successors[kFragSuccBranch]);
+
+      // Motivation: Flags are not used to pass arguments to functions, so
+      //             the app flags are dead on entry to the callee.
+      if (FLAG_assume_abi_dead_flags && frag->branch_instr->IsFunctionCall()) {
+        branch_live.app_flags = 0;
+      }
+      return branch_live;
     }
   }
 
@@ -106,15 +137,45 @@ static LiveFlags LiveFlagsOnExit(Fragment *frag) {
   };
 }
 
+// Returns the application program counter targeted by an exit fragment, or
+// `nullptr` if the target isn't known.
+static AppPC ExitFragmentTargetPC(ExitFragment *frag) {
+  if (frag->block_meta) {
+    return MetaDataCast<AppMetaData *>(frag->block_meta)->start_pc;
+  } else {
+    return nullptr;
+  }
+}
+
+// Returns the set of app flags that are live on entry to an exit fragment.
+//
+// An exit fragment ending in a function return doesn't need to preserve any
+// flags (per the ABI). An exit fragment that leads into a block whose first
+// instruction kills some flags doesn't need to preserve those flags either.
+static uint32_t ExitFragmentLiveFlags(ExitFragment *frag) {
+  auto all_flags = arch::AllArithmeticFlags();
+  if (!FLAG_assume_abi_dead_flags) return all_flags;
+
+  if (auto cfi = DynamicCast<ControlFlowInstruction *>(frag->instrs.First())) {
+    if (cfi->IsFunctionReturn()) return 0;
+    return all_flags;
+  }
+  if (auto target_pc = ExitFragmentTargetPC(frag)) {
+    return arch::AppEntryLiveFlags(target_pc) & all_flags;
+  }
+  return all_flags;
+}
+
 static void InitFlagsUse(FragmentList *frags) {
   auto all_flags = arch::AllArithmeticFlags();
   for (auto frag : ReverseFragmentListIterator(frags)) {
     if (auto exit_frag = DynamicCast<ExitFragment *>(frag)) {
+      auto live_flags = ExitFragmentLiveFlags(exit_frag);
       auto &flags(exit_frag->app_flags);
       flags.all_read_flags = all_flags;
       flags.all_written_flags = all_flags;
-      flags.entry_live_flags = all_flags;
-      flags.exit_live_flags = all_flags;
+      flags.entry_live_flags = live_flags;
+      flags.exit_live_flags = live_flags;
     }
   }
 }
@@ -123,6 +184,7 @@ static void InitFlagsUse(FragmentList *frags) {
 // and what flags are read/written anywhere within the fragment.
 static bool TryUpdateFlagsUse(Fragment *frag) {
   GRANARY_ASSERT(kFragmentKindInvalid != frag->kind);
+  if (IsA<ExitFragment *>(frag)) return false;  // Fixed by `InitFlagsUse`.
 
   FlagUsageInfo *flags(nullptr);
   FlagUsageInfo new_flags;
@@ -172,10 +234,73 @@ static bool TryUpdateFlagsUse(Fragment *frag) {
 //          that we can know exactly which app flags inst fragments clobber.
 static void AnalyzeFlagsUse(FragmentList *frags) {
   InitFlagsUse(frags);
+  FragmentSnapshot snapshot(frags);
   for (auto changed = true; changed; ) {
     changed = false;
-    for (auto frag : ReverseFragmentListIterator(frags)) {
-      changed = TryUpdateFlagsUse(frag) || changed;
+    for (auto i = snapshot.Size(); i--; ) {
+      changed = TryUpdateFlagsUse(snapshot[i]) || changed;
+    }
+  }
+}
+
+// Returns the flags read and written by a single instruction.
+static FlagUsageInfo InstructionFlagsUse(const arch::Instruction &instr) {
+  FlagUsageInfo flags;
+  arch::VisitInstructionFlags(instr, &flags);
+  return flags;
+}
+
+// Try to convert the instrumentation instructions of an instrumentation
+// fragment into flag-free forms (e.g. `ADD` into `LEA`) when the flags that
+// those instructions write are not read by any later instrumentation. If we
+// are able to remove all flag writes from a fragment, then we won't need to
+// save and restore the application's flags around it.
+//
+// Note: Converting an instruction in this way doesn't change the live flags on
+//       entry/exit of the fragment, because the written flags being converted
+//       were already dead after the instruction.
+static void ConvertToFlagFreeInstructions(CodeFragment *frag) {
+  FlagUsageInfo flags;
+  flags.entry_live_flags = frag->inst_flags.exit_live_flags;
+
+  auto converted = false;
+  for (auto instr : ReverseInstructionListIterator(frag->instrs)) {
+    auto ninstr = DynamicCast<NativeInstruction *>(instr);
+    if (!ninstr) continue;
+    if (!ninstr->IsAppInstruction()) {
+      auto instr_flags = InstructionFlagsUse(ninstr->instruction);
+      if (instr_flags.all_written_flags && !instr_flags.all_read_flags &&
+          !(instr_flags.all_written_flags & flags.entry_live_flags) &&
+          arch::TryConvertToFlagFreeInstruction(&(ninstr->instruction))) {
+        converted = true;
+      }
+    }
+    arch::VisitInstructionFlags(ninstr->instruction, &flags);
+  }
+
+  if (!converted) return;
+
+  // Re-compute the set of written flags of this fragment.
+  frag->inst_flags.all_written_flags = 0;
+  for (auto instr : InstructionListIterator(frag->instrs)) {
+    if (auto ninstr = DynamicCast<NativeInstruction *>(instr)) {
+      auto instr_flags = InstructionFlagsUse(ninstr->instruction);
+      frag->inst_flags.all_written_flags |= instr_flags.all_written_flags;
+    }
+  }
+  frag->attr.modifies_flags = !!frag->inst_flags.all_written_flags;
+}
+
+// Remove flag writes from instrumentation fragments where some application
+// flags are live. Instrumentation fragments where no app flags are live don't
+// need to save/restore the flags anyway.
+static void ConvertToFlagFreeInstructions(FragmentList *frags) {
+  for (auto frag : FragmentListIterator(frags)) {
+    if (kFragmentKindInst != frag->kind) continue;
+    if (!frag->app_flags.exit_live_flags) continue;
+    if (!frag->inst_flags.all_written_flags) continue;
+    if (auto code_frag = DynamicCast<CodeFragment *>(frag)) {
+      ConvertToFlagFreeInstructions(code_frag);
     }
   }
 }
@@ -445,6 +570,7 @@ static void PropagateCodeCacheKinds(FragmentList *frags) {
 void AddEntryAndExitFragments(FragmentList *frags) {
   PropagateFragKinds(frags);
   AnalyzeFlagsUse(frags);
+  ConvertToFlagFreeInstructions(frags);
   CombineFlagZones(frags);
   UpdateFlagZones(frags);
 
@@ -151,10 +151,11 @@ static bool BackPropagateEntryDefs(CodeFragment *pred, CodeFragment *succ) {
 
 // Back-propagate VRs through the fragment list.
 static void BackPropagateEntryDefs(FragmentList *frags) {
+  FragmentSnapshot snapshot(frags);
   for (auto changed = true; changed; ) {
     changed = false;
-    for (auto frag : ReverseFragmentListIterator(frags)) {
-      if (auto cfrag = DynamicCast<CodeFragment *>(frag)) {
+    for (auto i = snapshot.Size(); i--; ) {
+      if (auto cfrag = DynamicCast<CodeFragment *>(snapshot[i])) {
         for (auto succ : cfrag->successors) {
           if (auto succ_cfrag = DynamicCast<CodeFragment *>(succ)) {
             changed = BackPropagateEntryDefs(cfrag, succ_cfrag) || changed;
@@ -3,14 +3,28 @@
 #define GRANARY_INTERNAL
 #define GRANARY_ARCH_INTERNAL
 
+#include "granary/base/option.h"
+
 #include "granary/cfg/instruction.h"
 
 #include "granary/code/fragment.h"
 
 #include "granary/code/assemble/8_schedule_registers.h"
 
+#include "granary/cache.h"
 #include "granary/util.h"
 
+GRANARY_DEFINE_bool(global_register_allocation, false,
+    "Should Granary schedule virtual registers using a global allocator? The "
+    "global allocator assigns a home GPR to each virtual register by "
+    "coloring the interference graph of the virtual registers' live ranges "
+    "(over the whole fragment graph), and prefers spilling virtual registers "
+    "with low spill costs to slots. The default is `no`, which uses the "
+    "greedy, first-come first-served scheduler.\n"
+    "\n"
+    "Note: This is a good way to compare the two schedulers against each\n"
+    "      other in terms of the number of spills and fills.");
+
 namespace granary {
 namespace arch {
 
@@ -78,13 +92,38 @@ static void GetSchedulableVRs(FragmentList *frags, VRIdSet *vrs) {
   }
 }
 
+// Information used by the global allocator to home a virtual register.
+struct VRAllocation {
+  // Weighted estimate of the cost of keeping the VR in a spill slot across
+  // control-flow edges.
+  size_t spill_cost;
+
+  // Weighted estimate of the cost of keeping the VR in each GPR across
+  // control-flow edges. The cost comes from the native uses of the GPR
+  // within the live range of the VR, each of which splits the live range
+  // of the VR.
+  size_t gpr_cost[arch::NUM_GENERAL_PURPOSE_REGISTERS];
+
+  // The GPR in which the VR is homed across control-flow edges. If this is
+  // invalid, then the VR is homed in `slot`.
+  VirtualRegister gpr;
+  size_t slot;
+
+  bool is_allocated;
+};
+
+typedef TinyMap<uint16_t, VRAllocation, arch::NUM_GENERAL_PURPOSE_REGISTERS>
+        VRAllocationMap;
+
 struct RegisterScheduler {
   RegisterScheduler(void)
       : num_slots(0),
         is_in_slot{false},
         slot_for_gpr{0},
         gpr_has_slot(),
-        gpr_counts() {}
+        gpr_counts(),
+        homed_gprs(),
+        allocs(nullptr) {}
 
   // Recounts the uses of GPRs across all frags.
   void ResetGlobal(FragmentList *frags) {
@@ -93,9 +132,26 @@ struct RegisterScheduler {
   }
 
   // Recounts the uses of GPRs within a specific frag.
-  void ResetLocal(Fragment *frag) {
+  void ResetLocal(CodeFragment *frag) {
     gpr_counts.ClearGPRUseCounters();
     gpr_counts.CountGPRUses(frag);
+    ResetHomedGPRs(frag);
+  }
+
+  // When using the global allocator, find the GPRs that are homes to VRs
+  // that are live somewhere within `frag`. We avoid choosing these GPRs as
+  // temporary homes for VRs, as that would clobber the VRs' values.
+  void ResetHomedGPRs(CodeFragment *frag) {
+    homed_gprs.KillAll();
+    if (!allocs) return;
+    for (auto vr_id : frag->exit_regs) AddHomedGPR(vr_id);
+    for (auto vr_id : frag->entry_regs) AddHomedGPR(vr_id);
+  }
+
+  void AddHomedGPR(uint16_t vr_id) {
+    if (!allocs->Exists(vr_id)) return;
+    const auto &alloc((*allocs)[vr_id]);
+    if (alloc.is_allocated && alloc.gpr.IsValid()) homed_gprs.Revive(alloc.gpr);
   }
 
   // Resets the GPR slots. We put `kAnnotRegisterSave/Restore/SwapRestore` in a
@@ -132,12 +188,23 @@ struct RegisterScheduler {
   }
 
   // Return the least used GPR for use that's not also used in `used_regs`.
+  // We try to avoid the homes of other VRs, but if that's not possible then
+  // we fall back on any GPR not in `used_regs`.
   VirtualRegister GetGPR(const UsedRegisterSet &used_regs) {
+    auto gpr = GetGPR(used_regs, homed_gprs);
+    if (!gpr.IsValid()) gpr = GetGPR(used_regs, UsedRegisterSet());
+    return gpr;
+  }
+
+  // Return the least used GPR for use that's not also used in `used_regs` or
+  // in `avoid_regs`.
+  VirtualRegister GetGPR(const UsedRegisterSet &used_regs,
+                         const UsedRegisterSet &avoid_regs) {
     auto found_reg = false;
     auto min_gpr_num = static_cast<size_t>(arch::NUM_GENERAL_PURPOSE_REGISTERS);
     auto min_num_uses = std::numeric_limits<size_t>::max();
     for (auto i = 0UL; i < arch::NUM_GENERAL_PURPOSE_REGISTERS; ++i) {
-      if (used_regs.IsLive(i)) continue;
+      if (used_regs.IsLive(i) || avoid_regs.IsLive(i)) continue;
       auto num_uses = gpr_counts.NumUses(i);
       if (num_uses < min_num_uses) {
         found_reg = true;
@@ -161,6 +228,13 @@ struct RegisterScheduler {
 
   // Counts of the number of uses of each register.
   RegisterUsageCounter gpr_counts;
+
+  // GPRs that are homes of VRs live within the current fragment. Only used
+  // by the global allocator.
+  UsedRegisterSet homed_gprs;
+
+  // Allocations of VRs to GPRs/slots. Only used by the global allocator.
+  VRAllocationMap *allocs;
 };
 
 // Returns `true` if `vr_id` is used in or defined by `instr`.
@@ -461,23 +535,49 @@ static void ScheduleSaveRestores(RegisterScheduler *sched,
   }
 }
 
-// Assign the slots to the partitions for later slot allocation.
-static void MarkPartitionUseCounts(RegisterScheduler *sched,
-                                   FragmentList *frags) {
-  if (!sched->num_slots) return;
+// Schedule the virtual register with id `vr_id` across all fragments. If
+// `preferred_gpr` is valid, then the VR will be homed to that GPR across
+// control-flow edges, otherwise it will be homed to the spill slot `slot`.
+static void ScheduleRegisters(RegisterScheduler *sched, FragmentList *frags,
+                              const uint16_t vr_id,
+                              const VirtualRegister preferred_gpr,
+                              const size_t slot) {
   for (auto frag : FragmentListIterator(frags)) {
-    if (auto partition = frag->partition.Value()) {
-      if (partition->uses_vrs) partition->num_slots = sched->num_slots;
+    if (auto cfrag = DynamicCast<CodeFragment *>(frag)) {
+
+      // This VR has a preferred GPR, and so it will be homed to that GPR
+      // across control-flow transfers.
+      if (preferred_gpr.IsValid()) {
+
+        // Only thing in compensation fragments are implicit register
+        // kills for VRs that are homed to preferred GPRs.
+        if (cfrag->attr.is_compensation_frag) {
+          if (cfrag->entry_regs.Contains(vr_id) &&
+              !cfrag->exit_regs.Contains(vr_id)) {
+            cfrag->instrs.Prepend(arch::RestoreGPRFromSlot(
+                preferred_gpr, sched->SlotForGPR(preferred_gpr)));
+          }
+
+        } else {
+          ScheduleRegisters(sched, cfrag, vr_id, preferred_gpr);
+        }
+
+      // Without preferred GRPs, all transfers will end up going through
+      // spill slots anyway, so there is no interference with compensation
+      // code.
+      } else if (!cfrag->attr.is_compensation_frag) {
+        ScheduleRegisters(sched, cfrag, vr_id, slot);
+      }
     }
   }
 }
 
-}  // namespace
-
-// Schedule virtual registers.
-void ScheduleRegisters(FragmentList *frags) {
+// Schedule virtual registers using a greedy approach, where VRs are assigned
+// to GPRs that are unused by any fragment in a first-come first-served
+// fashion.
+static void ScheduleRegistersGreedy(RegisterScheduler *sched,
+                                    FragmentList *frags) {
   VRIdSet vrs;
-  RegisterScheduler sched;
   UsedRegisterSet preferred_gprs;
 
   // TODO(pag): Weighted sorting of VRs by number of uses, where the number of
@@ -485,7 +585,7 @@ void ScheduleRegisters(FragmentList *frags) {
   GetSchedulableVRs(frags, &vrs);
 
   for (auto vr_id : vrs) {
-    sched.ResetGlobal(frags);
+    sched->ResetGlobal(frags);
 
     // Allocate a slot for the VR, and try to find a preferred GPR for the VR.
     // The idea with the preferred GPRs is that we ideally want the VR to be
@@ -493,44 +593,191 @@ void ScheduleRegisters(FragmentList *frags) {
     // Specifically, we also want the GPR to be homed to its preferred GPR
     // across control-flow edges. Otherwise, we say the VR is always in its
     // slot across control-flow edges.
-    auto preferred_gpr = sched.GetPreferredGPR(preferred_gprs);
+    auto preferred_gpr = sched->GetPreferredGPR(preferred_gprs);
     auto slot = 0UL;
     if (preferred_gpr.IsValid()) {
       preferred_gprs.Revive(preferred_gpr);
     } else {
-      slot = sched.num_slots++;
+      slot = sched->num_slots++;
     }
+    ScheduleRegisters(sched, frags, vr_id, preferred_gpr, slot);
+  }
+}
 
-    for (auto frag : FragmentListIterator(frags)) {
-      if (auto cfrag = DynamicCast<CodeFragment *>(frag)) {
+enum : size_t {
+  // Number of GPRs that the global allocator leaves unassigned within every
+  // fragment, so that there are always some GPRs available for temporarily
+  // homing slot-allocated VRs and for re-homing GPR-allocated VRs.
+  NUM_UNHOMED_GPRS = 4,
 
-        // This VR has a preferred GPR, and so it will be homed to that GPR
-        // across control-flow transfers.
-        if (preferred_gpr.IsValid()) {
+  // Relative weight of code in the hot code cache, versus other code.
+  HOT_CODE_WEIGHT = 8
+};
 
-          // Only thing in compensation fragments are implicit register
-          // kills for VRs that are homed to preferred GPRs.
-          if (cfrag->attr.is_compensation_frag) {
-            if (cfrag->entry_regs.Contains(vr_id) &&
-                !cfrag->exit_regs.Contains(vr_id)) {
-              cfrag->instrs.Prepend(arch::RestoreGPRFromSlot(
-                  preferred_gpr, sched.SlotForGPR(preferred_gpr)));
-            }
+// Returns the weight of the costs associated with some fragment.
+static size_t FragmentWeight(const CodeFragment *frag) {
+  return kCodeCacheKindHot == frag->cache ? HOT_CODE_WEIGHT : 1;
+}
 
-          } else {
-            ScheduleRegisters(&sched, cfrag, vr_id, preferred_gpr);
-          }
+// Returns `true` if the VR with id `vr_id` is in the live range of `frag`.
+static bool IsInLiveRange(const CodeFragment *frag, uint16_t vr_id) {
+  return frag->exit_regs.Contains(vr_id) || frag->entry_regs.Contains(vr_id);
+}
+
+// Computes the spill costs of each VR and of homing each VR to each GPR.
+static void ComputeAllocationCosts(FragmentList *frags, VRAllocationMap *allocs,
+                                   const VRIdSet &vrs) {
+  for (auto vr_id : vrs) {
+    (*allocs)[vr_id] = VRAllocation();
+  }
+  RegisterUsageCounter gpr_counts;
+  for (auto frag : FragmentListIterator(frags)) {
+    auto cfrag = DynamicCast<CodeFragment *>(frag);
+    if (!cfrag || cfrag->attr.is_compensation_frag) continue;
 
-        // Without preferred GRPs, all transfers will end up going through
-        // spill slots anyway, so there is no interference with compensation
-        // code.
-        } else if (!cfrag->attr.is_compensation_frag) {
-          ScheduleRegisters(&sched, cfrag, vr_id, slot);
+    gpr_counts.ClearGPRUseCounters();
+    gpr_counts.CountGPRUses(cfrag);
+
+    const auto weight = FragmentWeight(cfrag);
+    for (auto vr_id : vrs) {
+      if (!IsInLiveRange(cfrag, vr_id)) continue;
+      auto &alloc((*allocs)[vr_id]);
+
+      // Every fragment that uses or defines the VR needs to fill the VR from
+      // its slot (and potentially spill it back to its slot).
+      for (auto instr : InstructionListIterator(cfrag->instrs)) {
+        auto ninstr = DynamicCast<NativeInstruction *>(instr);
+        if (ninstr && IsUsedOrDefined(ninstr, vr_id)) {
+          alloc.spill_cost += weight;
+          break;
         }
       }
+
+      // Every native use of a GPR splits the live range of a VR homed in
+      // that GPR.
+      for (auto i = 0UL; i < arch::NUM_GENERAL_PURPOSE_REGISTERS; ++i) {
+        alloc.gpr_cost[i] += weight * gpr_counts.NumUses(i);
+      }
+    }
+  }
+}
+
+// Returns the next unallocated VR with the highest spill cost, or `0` if all
+// VRs have been allocated.
+static uint16_t NextVRToAllocate(VRAllocationMap *allocs, const VRIdSet &vrs) {
+  uint16_t max_vr_id(0);
+  size_t max_spill_cost(0);
+  for (auto vr_id : vrs) {
+    const auto &alloc((*allocs)[vr_id]);
+    if (alloc.is_allocated) continue;
+    if (!max_vr_id || alloc.spill_cost > max_spill_cost) {
+      max_vr_id = vr_id;
+      max_spill_cost = alloc.spill_cost;
+    }
+  }
+  return max_vr_id;
+}
+
+// Find the GPRs that are unavailable for homing the VR with id `vr_id`. A GPR
+// is unavailable if it is the home of an interfering VR, i.e. a VR whose live
+// range overlaps with the live range of `vr_id`. Returns `false` if homing
+// `vr_id` to any GPR would leave too few GPRs free within some fragment.
+static bool FindUnavailableGPRs(FragmentList *frags, VRAllocationMap *allocs,
+                                const VRIdSet &vrs, uint16_t vr_id,
+                                UsedRegisterSet *unavailable_gprs) {
+  for (auto frag : FragmentListIterator(frags)) {
+    auto cfrag = DynamicCast<CodeFragment *>(frag);
+    if (!cfrag || !IsInLiveRange(cfrag, vr_id)) continue;
+
+    UsedRegisterSet homed_gprs;
+    auto num_homed_gprs = 0UL;
+    for (auto other_vr_id : vrs) {
+      if (other_vr_id == vr_id) continue;
+      if (!IsInLiveRange(cfrag, other_vr_id)) continue;
+      const auto &alloc((*allocs)[other_vr_id]);
+      if (!alloc.is_allocated || !alloc.gpr.IsValid()) continue;
+      if (homed_gprs.IsDead(alloc.gpr)) {
+        homed_gprs.Revive(alloc.gpr);
+        ++num_homed_gprs;
+      }
+    }
+    if ((num_homed_gprs + 1 + NUM_UNHOMED_GPRS) >
+        arch::NUM_GENERAL_PURPOSE_REGISTERS) {
+      return false;
+    }
+    unavailable_gprs->Union(homed_gprs);
+  }
+  return true;
+}
+
+// Allocate a home for the VR with id `vr_id`. We choose the available GPR with
+// the lowest cost, so long as that cost isn't higher than the cost of homing
+// the VR to a spill slot.
+static void AllocateVR(RegisterScheduler *sched, FragmentList *frags,
+                       const VRIdSet &vrs, uint16_t vr_id) {
+  auto allocs = sched->allocs;
+  UsedRegisterSet unavailable_gprs;
+  VirtualRegister best_gpr;
+  if (FindUnavailableGPRs(frags, allocs, vrs, vr_id, &unavailable_gprs)) {
+    const auto &alloc((*allocs)[vr_id]);
+    auto best_cost = alloc.spill_cost;
+    for (auto i = 0UL; i < arch::NUM_GENERAL_PURPOSE_REGISTERS; ++i) {
+      if (unavailable_gprs.IsLive(i)) continue;
+      if (alloc.gpr_cost[i] <= best_cost) {
+        best_gpr = NthArchGPR(i);
+        best_cost = alloc.gpr_cost[i];
+      }
     }
   }
 
+  auto &alloc((*allocs)[vr_id]);
+  alloc.is_allocated = true;
+  alloc.gpr = best_gpr;
+  if (!best_gpr.IsValid()) alloc.slot = sched->num_slots++;
+}
+
+// Schedule virtual registers using a global allocator. First, every VR is
+// assigned a home (a GPR or a spill slot) using a greedy coloring of the
+// interference graph of the VRs' live ranges, where VRs are colored in order
+// of decreasing spill cost. Then, the VRs are scheduled within each fragment,
+// which splits their live ranges around conflicting uses of their homes.
+static void ScheduleRegistersGlobal(RegisterScheduler *sched,
+                                    FragmentList *frags) {
+  VRIdSet vrs;
+  VRAllocationMap allocs;
+  GetSchedulableVRs(frags, &vrs);
+  ComputeAllocationCosts(frags, &allocs, vrs);
+
+  sched->allocs = &allocs;
+  while (auto vr_id = NextVRToAllocate(&allocs, vrs)) {
+    AllocateVR(sched, frags, vrs, vr_id);
+    const auto &alloc(allocs[vr_id]);
+    ScheduleRegisters(sched, frags, vr_id, alloc.gpr, alloc.slot);
+  }
+  sched->allocs = nullptr;
+}
+
+// Assign the slots to the partitions for later slot allocation.
+static void MarkPartitionUseCounts(RegisterScheduler *sched,
+                                   FragmentList *frags) {
+  if (!sched->num_slots) return;
+  for (auto frag : FragmentListIterator(frags)) {
+    if (auto partition = frag->partition.Value()) {
+      if (partition->uses_vrs) partition->num_slots = sched->num_slots;
+    }
+  }
+}
+
+}  // namespace
+
+// Schedule virtual registers.
+void ScheduleRegisters(FragmentList *frags) {
+  RegisterScheduler sched;
+  if (FLAG_global_register_allocation) {
+    ScheduleRegistersGlobal(&sched, frags);
+  } else {
+    ScheduleRegistersGreedy(&sched, frags);
+  }
   sched.ResetGPRSlots();
   ScheduleSaveRestores(&sched, frags);
   MarkPartitionUseCounts(&sched, frags);
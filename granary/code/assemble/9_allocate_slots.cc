@@ -9,6 +9,8 @@
 
 #include "granary/code/assemble/9_allocate_slots.h"
 
+#include "granary/stats.h"
+
 namespace granary {
 namespace arch {
 
@@ -140,9 +142,10 @@ static void FindFrameSizes(FragmentList *frags) {
     if (!partition->analyze_stack_frame) continue;
     InitFrameAdjust(frag);
   }
+  FragmentSnapshot snapshot(frags);
   for (auto changed = true; changed; ) {
     changed = false;
-    for (auto frag : FragmentListIterator(frags)) {
+    for (auto frag : snapshot) {
       auto partition = frag->partition.Value();
       if (!partition->analyze_stack_frame) continue;
 
@@ -153,20 +156,46 @@ static void FindFrameSizes(FragmentList *frags) {
         if (succ->partition != frag->partition) continue;
         if (IsA<PartitionEntryFragment *>(succ)) continue;
 
-        // TODO(pag): What if we have something like:
+        // Note: If we have something like:
         //
         //      F1 --.-> F3
         //      F2 --'
         //
-        // Where `F1` and `F2` have different `exit_offset`s? This could
-        // happen if some instrumentation branches around something like a
-        // `PUSH` or a `POP` (on x86).
+        // Where `F1` and `F2` have different `exit_offset`s, then the entry
+        // offset of `F3` is ambiguous. This could happen if some
+        // instrumentation branches around something like a `PUSH` or a `POP`
+        // (on x86). These cases are caught by `VerifyFrameSizes`.
         succ->stack_frame.entry_offset = frag->stack_frame.exit_offset;
       }
     }
   }
 }
 
+#ifdef GRANARY_WHERE_user
+// Verify that the stack pointer offsets of every fragment agree with the
+// offsets of their predecessors. If they don't, then we can't statically
+// address stack-allocated spill slots within the partition, so we fall back
+// to using thread-local storage for the slots.
+//
+// Note: This is only done in user space. In kernel space, partitions that
+//       don't use the stack for their slots must disable interrupts, and
+//       that isn't done for partitions whose stack is otherwise valid.
+static void VerifyFrameSizes(FragmentList *frags) {
+  for (auto frag : FragmentListIterator(frags)) {
+    auto partition = frag->partition.Value();
+    if (!partition->analyze_stack_frame) continue;
+    for (auto succ : frag->successors) {
+      if (!succ) continue;
+      if (succ->partition != frag->partition) continue;
+      if (IsA<PartitionEntryFragment *>(succ)) continue;
+      if (succ->stack_frame.entry_offset != frag->stack_frame.exit_offset) {
+        partition->analyze_stack_frame = false;
+      }
+    }
+  }
+}
+#endif  // GRANARY_WHERE_user
+
 // Adjusts all instructions that read from or write to the stack pointer
 static void AdjustStackInstructions(Fragment *frag, int frame_space) {
   auto instr = frag->instrs.First();
@@ -258,6 +287,22 @@ static void AllocateSlotsStackInvalid(Fragment *frag) {
 
 #endif  // GRANARY_WHERE_kernel
 
+// Update the counts of stack-allocated and TLS-allocated spill slots.
+static void CountSlots(FragmentList *frags) {
+  for (auto frag : FragmentListIterator(frags)) {
+    if (!IsA<PartitionEntryFragment *>(frag)) continue;
+    auto partition = frag->partition.Value();
+    if (!partition->num_slots) continue;
+    if (partition->analyze_stack_frame) {
+      AddStat(kStatNumStackSlots, partition->num_slots);
+      AddStat(kStatNumStackPartitions);
+    } else {
+      AddStat(kStatNumTLSSlots, partition->num_slots);
+      AddStat(kStatNumTLSPartitions);
+    }
+  }
+}
+
 // Allocates space on the stack for virtual registers.
 static void AllocateStackSlots(FragmentList *frags) {
   for (auto frag : FragmentListIterator(frags)) {
@@ -279,6 +324,8 @@ static void AllocateStackSlots(FragmentList *frags) {
 void AllocateSlots(FragmentList *frags) {
   InitStackFrameAnalysis(frags);
   FindFrameSizes(frags);
+  GRANARY_IF_USER( VerifyFrameSizes(frags); )
+  if (GRANARY_UNLIKELY(FLAG_collect_stats)) CountSlots(frags);
   AllocateStackSlots(frags);
   arch::AllocateSlots(frags);
 }
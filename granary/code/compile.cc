@@ -18,6 +18,7 @@
 #include "granary/app.h"
 #include "granary/cache.h"
 #include "granary/context.h"
+#include "granary/stats.h"
 #include "granary/util.h"
 
 GRANARY_DEFINE_bool(debug_trace_exec, false,
@@ -281,19 +282,40 @@ static void ConnectEdgesToInstructions(FragmentList *frags) {
   }
 }
 
+// Allocate space in the code caches for the fragments. The first fragment is
+// placed at `chain_pc` if possible, so that it directly follows the code that
+// branched to it.
+static void AllocateFragmentCode(FragmentList *frags, CodeCacheUse *use,
+                                 CachePC chain_pc) {
+  const auto first_cache = frags->First()->cache;
+  for (auto i = 0; i < kNumCodeCacheKinds; ++i) {
+    const auto kind = static_cast<CodeCacheKind>(i);
+    auto &cache_code(use->cache_code[i]);
+    if (chain_pc && first_cache == kind) {
+      cache_code = AllocateCodeAt(kind, chain_pc, use->cache_size[i]);
+    }
+    if (!cache_code) {
+      cache_code = AllocateCode(kind, use->cache_size[i]);
+    }
+  }
+}
+
 // Encodes the fragments into the specified code caches.
-static CachePC EncodeAndFree(FragmentList *frags) {
+static CachePC EncodeAndFree(FragmentList *frags, CachePC chain_pc) {
   if (GRANARY_UNLIKELY(FLAG_debug_trace_exec)) AddBlockTracers(frags);
   CodeCacheUse cache_use = {{0}, {nullptr}};
-  StageEncode(frags, &cache_use);
-  for (auto i = 0; i < kNumCodeCacheKinds; ++i) {
-    cache_use.cache_code[i] = AllocateCode(static_cast<CodeCacheKind>(i),
-                                           cache_use.cache_size[i]);
+  {
+    StatTimer timer(kStatTimeStageEncode);
+    StageEncode(frags, &cache_use);
   }
+  AllocateFragmentCode(frags, &cache_use, chain_pc);
   auto update_addresses = false;
   RelativizeCode(frags, &cache_use, &update_addresses);
   RelativizeControlFlow(frags);
-  Encode(frags);
+  {
+    StatTimer timer(kStatTimeEncode);
+    Encode(frags);
+  }
   auto entry_pc = frags->First()->encoded_pc;
 
   // Go through all `kAnnotUpdateAddressWhenEncoded` annotations and update
@@ -308,19 +330,23 @@ static CachePC EncodeAndFree(FragmentList *frags) {
 
 }  // namespace
 
-// Compile some instrumented code.
-CachePC Compile(Context *context, Trace *cfg) {
+// Compile some instrumented code. If `chain_pc` is non-null, then the code
+// is placed at `chain_pc` if that is where the code cache would next place
+// code.
+CachePC Compile(Context *context, Trace *cfg, CachePC chain_pc) {
+  AddStat(kStatNumTranslations);
   auto frags = Assemble(context, cfg);
-  return EncodeAndFree(&frags);
+  return EncodeAndFree(&frags, chain_pc);
 }
 
 // Compile some instrumented code for an indirect edge.
 CachePC Compile(Context *context, Trace *cfg,
                 IndirectEdge *edge, BlockMetaData *meta) {
+  AddStat(kStatNumTranslations);
   auto frags = Assemble(context, cfg);
   auto target_app_pc = MetaDataCast<AppMetaData *>(meta)->start_pc;
   arch::InstantiateIndirectEdge(edge, &frags, target_app_pc);
-  return EncodeAndFree(&frags);
+  return EncodeAndFree(&frags, nullptr);
 }
 
 }  // namespace granary
@@ -14,8 +14,10 @@ class Context;
 class IndirectEdge;
 class Trace;
 
-// Compile some instrumented code.
-CachePC Compile(Context *context, Trace *cfg);
+// Compile some instrumented code. If `chain_pc` is non-null, then the code
+// is placed at `chain_pc` if that is where the code cache would next place
+// code.
+CachePC Compile(Context *context, Trace *cfg, CachePC chain_pc=nullptr);
 
 // Compile some instrumented code for an indirect edge.
 CachePC Compile(Context *context, Trace *cfg,
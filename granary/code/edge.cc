@@ -19,6 +19,8 @@ DirectEdge::DirectEdge(BlockMetaData *dest_meta_, DirectEdge *next_)
       dest_block_meta(dest_meta_),
       edge_code_pc(nullptr),
       patch_instruction_pc(nullptr),
+      num_executions(0),
+      next_sibling(this),
       lock() {}
 
 DirectEdge::~DirectEdge(void) {
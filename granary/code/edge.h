@@ -61,6 +61,16 @@ class DirectEdge {
   // Instruction that is patched by this direct edge.
   CachePC patch_instruction_pc;
 
+  // Number of times that the edge code of this edge has been executed. This
+  // is only maintained if `--profile_direct_edges` is enabled, and stops being
+  // updated if the edge is patched.
+  uint64_t num_executions;
+
+  // Next direct edge that was allocated while compiling the same trace. All
+  // edges of a trace form a ring, so that the execution counts of the other
+  // exits of a trace can be compared against this edge.
+  DirectEdge *next_sibling;
+
   // Lock that guards the modification of `dest_meta` and this structure.
   os::Lock lock;
 
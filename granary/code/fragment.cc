@@ -15,6 +15,7 @@
 #include "granary/util.h"
 
 #include "os/logging.h"
+#include "os/memory.h"
 
 #if defined(GRANARY_TARGET_debug) || defined(GRANARY_TARGET_test)
 # include "granary/base/option.h"
@@ -475,6 +476,31 @@ static void FreePartitionInfo(Fragment *frag) {
 
 }  // namespace
 
+// Take a snapshot of the fragments in `list`.
+FragmentSnapshot::FragmentSnapshot(FragmentList *list)
+    : frags(inline_frags),
+      num_frags(0),
+      num_pages(0) {
+  for (auto frag : FragmentListIterator(list)) {
+    GRANARY_UNUSED(frag);
+    ++num_frags;
+  }
+  if (kNumInlineFragments < num_frags) {
+    num_pages = GRANARY_ALIGN_TO(num_frags * sizeof(Fragment *),
+                                 arch::PAGE_SIZE_BYTES) /
+                arch::PAGE_SIZE_BYTES;
+    frags = reinterpret_cast<Fragment **>(os::AllocateDataPages(num_pages));
+  }
+  auto i = 0UL;
+  for (auto frag : FragmentListIterator(list)) {
+    frags[i++] = frag;
+  }
+}
+
+FragmentSnapshot::~FragmentSnapshot(void) {
+  if (num_pages) os::FreeDataPages(frags, num_pages);
+}
+
 // Free all fragments, their instructions, etc.
 void FreeFragments(FragmentList *frags) {
   for (auto frag : FragmentListIterator(frags)) {
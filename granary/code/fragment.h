@@ -244,6 +244,55 @@ typedef ListHeadIterator<Fragment> FragmentListIterator;
 typedef ReverseListHeadIterator<Fragment> ReverseFragmentListIterator;
 typedef LinkedListIterator<Fragment> EncodeOrderedFragmentIterator;
 
+// A flat snapshot of the fragments in a `FragmentList`, in list order.
+// Iterative data-flow passes walk a snapshot rather than the list, so that
+// each iteration reads a contiguous array of fragment pointers instead of
+// chasing `list` pointers that are spread throughout every fragment.
+//
+// Note: A snapshot does not see fragments that are added to or removed from
+//       the list after the snapshot is taken.
+class FragmentSnapshot {
+ public:
+  explicit FragmentSnapshot(FragmentList *list);
+  ~FragmentSnapshot(void);
+
+  // Number of fragments in the snapshot.
+  inline size_t Size(void) const {
+    return num_frags;
+  }
+
+  // Returns the `i`th fragment in the snapshot.
+  inline Fragment *operator[](size_t i) const {
+    GRANARY_ASSERT(i < num_frags);
+    return frags[i];
+  }
+
+  // Iteration in list order, e.g. `for (auto frag : snapshot)`.
+  inline Fragment * const *begin(void) const {
+    return frags;
+  }
+
+  inline Fragment * const *end(void) const {
+    return frags + num_frags;
+  }
+
+ private:
+  enum : size_t {
+    // Most fragment lists fit in the inline array, and so taking a snapshot of
+    // them doesn't need to allocate memory.
+    kNumInlineFragments = 32
+  };
+
+  FragmentSnapshot(void) = delete;
+
+  Fragment **frags;
+  size_t num_frags;
+  size_t num_pages;
+  Fragment *inline_frags[kNumInlineFragments];
+
+  GRANARY_DISALLOW_COPY_AND_ASSIGN(FragmentSnapshot);
+};
+
 
 // Used to count the number of uses of each GPR within one or more fragments.
 class RegisterUsageCounter {
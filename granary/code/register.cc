@@ -121,4 +121,10 @@ void LiveRegisterSet::Visit(const NativeInstruction *instr) {
   Visit(&(instr->instruction));
 }
 
+// Update this register tracker by marking all registers written by an
+// instruction.
+void WrittenRegisterSet::Visit(const NativeInstruction *instr) {
+  Visit(&(instr->instruction));
+}
+
 }  // namespace granary
@@ -254,6 +254,18 @@ union alignas(alignof(void *)) VirtualRegister {
     return is_stack_pointer;
   }
 
+  // Mark the value of this register as being an alias for some displacement of
+  // the frame pointer.
+  inline void MarkAsFramePointerAlias(void) {
+    is_frame_pointer = true;
+  }
+
+  // Does the current value of this register alias some displacement of the
+  // frame pointer?
+  inline bool IsFramePointerAlias(void) const {
+    return is_frame_pointer;
+  }
+
  private:
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wpacked"
@@ -291,6 +303,9 @@ union alignas(alignof(void *)) VirtualRegister {
 
     // Is this a stack pointer / alias of the stack pointer?
     bool is_stack_pointer:1;
+
+    // Is this an alias of the frame pointer?
+    bool is_frame_pointer:1;
   } __attribute__((packed));
 #pragma clang diagnostic pop
   uint64_t value;
@@ -563,6 +578,49 @@ class LiveRegisterSet : public RegisterSet {
 static_assert(sizeof(LiveRegisterSet) <= sizeof(uint64_t),
               "Invalid structure packing of `RegisterSet`.");
 
+// A class that tracks the general-purpose registers that are written within a
+// straight-line sequence of instructions.
+//
+// A register is written if any instruction writes to it, including partial
+// and conditional writes.
+//
+// Note: By default, all registers are treated as not written (i.e. dead).
+class WrittenRegisterSet : public RegisterSet {
+ public:
+  inline WrittenRegisterSet(void) {
+    KillAll();
+  }
+
+  typedef detail::RegisterSetIterator<true> Iterator;
+
+  inline Iterator begin(void) const {
+    return Iterator(this);
+  }
+
+  inline Iterator end(void) const {
+    return Iterator();
+  }
+
+  // Update this register tracker by marking all registers written by an
+  // instruction.
+  void Visit(const NativeInstruction *instr);
+
+  // Note: This function has an architecture-specific implementation.
+  GRANARY_INTERNAL_DEFINITION
+  void Visit(const arch::Instruction *instr);
+
+  // Note: This function has an architecture-specific implementation.
+  GRANARY_INTERNAL_DEFINITION
+  void Visit(const arch::Operand *op);
+
+  inline void Join(const WrittenRegisterSet &that) {
+    Union(that);
+  }
+};
+
+static_assert(sizeof(WrittenRegisterSet) <= sizeof(uint64_t),
+              "Invalid structure packing of `RegisterSet`.");
+
 }  // namespace granary
 
 #endif  // GRANARY_CODE_REGISTER_H_
@@ -8,6 +8,7 @@
 
 #include "granary/app.h"
 #include "granary/context.h"
+#include "granary/stats.h"
 #include "granary/translate.h"
 
 GRANARY_DEFINE_bool(unsafe_patch_edges, false,
@@ -16,6 +17,15 @@ GRANARY_DEFINE_bool(unsafe_patch_edges, false,
     "architectural requirements to cross-modifying code, and as such, enabling "
     "this option can result in spurious faults.");
 
+GRANARY_DEFINE_bool(chain_fall_through_blocks, false,
+    "Should Granary place the target of a direct jump immediately after the "
+    "jump in the code cache, if the jump is the last code in the code cache "
+    "when its target is first translated? If enabled, then the jump is "
+    "replaced by a `NOP`, so that straight-line application code executes "
+    "straight-line in the code cache. Like `--unsafe_patch_edges`, this "
+    "patches code that might be executing, and so it can result in spurious "
+    "faults. The default is `no`.");
+
 // TODO(pag): Add an option that says put edge code in for all blocks, even if
 //            not needed.
 
@@ -23,7 +33,7 @@ GRANARY_DEFINE_bool(unsafe_patch_edges, false,
 
 namespace granary {
 
-extern ReaderWriterLock gExitGranaryLock;
+extern DistributedReaderWriterLock gExitGranaryLock;
 
 namespace arch {
 
@@ -32,6 +42,18 @@ namespace arch {
 // Note: This function has an architecture-specific implementation.
 extern bool TryAtomicPatchEdge(DirectEdge *edge);
 
+// Returns the address of the instruction that immediately follows the
+// instruction patched by `edge`, if that instruction is a direct `JMP`.
+// Returns `nullptr` otherwise.
+//
+// Note: This function has an architecture-specific implementation.
+extern CachePC FallThroughChainPC(const DirectEdge *edge);
+
+// Elide the direct `JMP` patched by `edge` by replacing it with a `NOP`.
+//
+// Note: This function has an architecture-specific implementation.
+extern bool TryElideChainedJump(DirectEdge *edge);
+
 }  // namespace arch
 namespace {
 
@@ -57,19 +79,34 @@ static bool EdgeHasTranslation(const DirectEdge *edge) {
   return edge->entry_target_pc < begin || edge->entry_target_pc >= end;
 }
 
+// Returns the address at which the target of `edge` should be placed so that
+// it directly follows the jump to `edge`, or `nullptr` if the target should be
+// placed wherever the code cache chooses.
+static CachePC ChainPC(const DirectEdge *edge) {
+  if (!FLAG_chain_fall_through_blocks) return nullptr;
+  return arch::FallThroughChainPC(edge);
+}
+
 }  // namespace
 extern "C" {
 
 // Enter into Granary to begin the translation process for a direct edge.
 GRANARY_ENTRYPOINT void granary_enter_direct_edge(DirectEdge *edge) {
   GRANARY_IF_KERNEL(GRANARY_ASSERT(OnGranaryStack()));
-  ReadLockedRegion exit_locker(&gExitGranaryLock);
+  DistributedReadLockedRegion exit_locker(&gExitGranaryLock);
+  StatTimer timer(kStatTimeDirectEdgeEntry);
+  AddStat(kStatNumDirectEdgeEntries);
   os::LockedRegion edge_locker(&edge->lock);
   if (!EdgeHasTranslation(edge)) {
+    AddStat(kStatNumDirectEdgeTranslations);
     auto context = GlobalContext();
-    edge->entry_target_pc = Translate(context, edge->dest_block_meta);
+    auto chain_pc = ChainPC(edge);
+    edge->entry_target_pc = Translate(context, edge, chain_pc);
     edge->dest_block_meta = nullptr;
-    if (!FLAG_unsafe_patch_edges || !arch::TryAtomicPatchEdge(edge)) {
+    if (chain_pc && chain_pc == edge->entry_target_pc &&
+        arch::TryElideChainedJump(edge)) {
+      AddStat(kStatNumChainedBlocks);
+    } else if (!FLAG_unsafe_patch_edges || !arch::TryAtomicPatchEdge(edge)) {
       context->PreparePatchDirectEdge(edge);
     }
   }
@@ -79,10 +116,13 @@ GRANARY_ENTRYPOINT void granary_enter_direct_edge(DirectEdge *edge) {
 GRANARY_ENTRYPOINT void granary_enter_indirect_edge(IndirectEdge *edge,
                                                     AppPC target_app_pc) {
   GRANARY_IF_KERNEL(GRANARY_ASSERT(OnGranaryStack()));
-  ReadLockedRegion exit_locker(&gExitGranaryLock);
+  DistributedReadLockedRegion exit_locker(&gExitGranaryLock);
+  StatTimer timer(kStatTimeIndirectEdgeEntry);
+  AddStat(kStatNumIndirectEdgeEntries);
   os::LockedRegion edge_locker(&(edge->lock));
   auto &encoded_pc(edge->out_edges[target_app_pc]);
   if (!encoded_pc) {
+    AddStat(kStatNumIndirectEdgeTranslations);
     auto context = GlobalContext();
     auto meta = edge->dest_block_meta_template->Copy();
     auto app_meta = MetaDataCast<AppMetaData *>(meta);
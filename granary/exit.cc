@@ -9,6 +9,7 @@
 #include "granary/context.h"
 #include "granary/index.h"
 #include "granary/metadata.h"
+#include "granary/stats.h"
 
 #include "code/register.h"
 
@@ -18,7 +19,7 @@
 
 namespace granary {
 
-ReaderWriterLock gExitGranaryLock;
+DistributedReaderWriterLock gExitGranaryLock;
 
 extern "C" {
 // Exported to assembly code. This is the "fast" version of Granary's exit,
@@ -32,6 +33,7 @@ void granary_exit(ExitReason reason) {
   Exit(reason);
 #else
   ExitTools(reason);
+  LogStats();
   os::ExitLog();
 #endif  // GRANARY_WITH_VALGRIND
 }
@@ -67,6 +69,7 @@ void Exit(ExitReason reason) {
   FreeAllVirtualRegisters();
 
   arch::Exit();
+  LogStats();
   os::ExitLog();
   os::ExitModuleManager();
   PostExit();  // Tricky tricky!
@@ -10,6 +10,7 @@
 #include "granary/cache.h"
 #include "granary/index.h"
 #include "granary/metadata.h"
+#include "granary/stats.h"
 
 #include "os/memory.h"
 
@@ -167,10 +168,16 @@ IndexFindResponse FindMetaDataInIndex(const BlockMetaData *meta) {
   auto pc = AppPCOf(meta);
   GRANARY_ASSERT(nullptr != pc);
 
+  StatTimer timer(kStatTimeIndexLookup);
+  AddStat(kStatNumIndexLookups);
   auto indices = IndexOf(pc);
   if (auto array = gIndex[indices.first]) {
     if (auto metas = array->metas[indices.second]) {
-      return MatchMetaData(metas, meta);
+      auto response = MatchMetaData(metas, meta);
+      if (kUnificationStatusReject != response.status) {
+        AddStat(kStatNumIndexHits);
+      }
+      return response;
     }
   }
   return {kUnificationStatusReject, nullptr};  // Not in the index
@@ -186,6 +193,7 @@ void AddMetaDataToIndex(BlockMetaData *meta) {
   auto pc = AppPCOf(meta);
   GRANARY_ASSERT(nullptr != pc);
 
+  AddStat(kStatNumIndexInsertions);
   auto indices = IndexOf(pc);
   os::LockedRegion locker(&(gSecondLevelLocks[indices.second]));
 
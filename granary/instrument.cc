@@ -14,6 +14,7 @@
 #include "granary/breakpoint.h"
 #include "granary/context.h"
 #include "granary/metadata.h"
+#include "granary/stats.h"
 #include "granary/tool.h"
 
 GRANARY_DEFINE_positive_int(max_num_control_flow_iterations, 8,
@@ -21,6 +22,14 @@ GRANARY_DEFINE_positive_int(max_num_control_flow_iterations, 8,
     "pass per trace request. The default value is `8`, which--despite being "
     "small--could result in a massive blowup of code.");
 
+GRANARY_DEFINE_bool(incremental_control_flow, true,
+    "Should tools only be asked to instrument control flow when the previous "
+    "iteration of control-flow instrumentation materialized new blocks? If "
+    "enabled, then the control-flow instrumentation loop ends as soon as an "
+    "iteration makes no new materialization requests, and tools must only "
+    "look at `Trace::NewBlocks` when instrumenting control flow. The default "
+    "is `yes`.");
+
 namespace granary {
 
 // Initialize a binary instrumenter.
@@ -36,6 +45,7 @@ BinaryInstrumenter::~BinaryInstrumenter(void) {
 
 // Instrument some code as-if it is targeted by a direct CFI.
 void BinaryInstrumenter::InstrumentDirect(void) {
+  StatTimer timer(kStatTimeInstrument);
   auto entry_block = factory.RequestDirectEntryBlock(meta);
   if (!entry_block) {  // Couldn't find or adapt to a existing block.
     entry_block = factory.MaterializeDirectEntryBlock(*meta);
@@ -55,6 +65,7 @@ void BinaryInstrumenter::InstrumentDirect(void) {
 
 // Instrument some code as-if it is targeted by an indirect CFI.
 void BinaryInstrumenter::InstrumentIndirect(void) {
+  StatTimer timer(kStatTimeInstrument);
   factory.MaterializeIndirectEntryBlock(*meta);
   InstrumentControlFlow();
   InstrumentBlocks();
@@ -66,6 +77,7 @@ void BinaryInstrumenter::InstrumentIndirect(void) {
 // are treated as being the initial points of instrumentation.
 void BinaryInstrumenter::InstrumentEntryPoint(EntryPointKind kind,
                                               int category) {
+  StatTimer timer(kStatTimeInstrument);
   factory.MaterializeIndirectEntryBlock(*meta);
   auto entry_block = DynamicCast<CompensationBlock *>(trace->EntryBlock());
   for (auto tool : ToolIterator(tools)) {
@@ -98,11 +110,17 @@ static bool FinalizeControlFlow(BlockFactory *factory,
 // Repeatedly apply trace-wide instrumentation for every tool, where tools are
 // allowed to materialize direct basic blocks into other forms of basic
 // blocks.
+//
+// Note: In incremental mode, tools are skipped on iterations where nothing new
+//       was materialized. Such iterations can't add requests, because
+//       `InstrumentControlFlow` only looks at the new blocks.
 void BinaryInstrumenter::InstrumentControlFlow(void) {
   auto stop = false;
   for (auto num_iterations = 1; ; factory.MaterializeRequestedBlocks()) {
-    for (auto tool : ToolIterator(tools)) {
-      tool->InstrumentControlFlow(&factory, trace);
+    if (!FLAG_incremental_control_flow || trace->HasNewBlocks()) {
+      for (auto tool : ToolIterator(tools)) {
+        tool->InstrumentControlFlow(&factory, trace);
+      }
     }
     if (stop) break;
     if (!factory.HasPendingMaterializationRequest()) {
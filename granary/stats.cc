@@ -0,0 +1,169 @@
+/* Copyright 2015 Peter Goodman, all rights reserved. */
+
+#define GRANARY_INTERNAL
+
+#include "granary/stats.h"
+
+#include "os/logging.h"
+#include "os/thread.h"
+
+GRANARY_DEFINE_bool(collect_stats, false,
+    "Should Granary collect statistics about its own execution, e.g. how many "
+    "blocks it decoded, how much code cache memory it used, and how many "
+    "cycles it spent in each phase of translation? If enabled, then the "
+    "statistics are logged as a JSON object when Granary exits. The default "
+    "is `no`.");
+
+namespace granary {
+namespace {
+
+enum : size_t {
+  // Counters are striped so that different threads (usually) update different
+  // cache lines.
+  kNumStatStripes = 16
+};
+
+struct alignas(arch::CACHE_LINE_SIZE_BYTES) StatStripe {
+  std::atomic<uint64_t> counters[kNumStatCounters];
+  std::atomic<uint64_t> timer_cycles[kNumStatTimers];
+  std::atomic<uint64_t> timer_counts[kNumStatTimers];
+};
+
+static StatStripe gStats[kNumStatStripes];
+
+static const char * const kStatCounterNames[] = {
+  "num_translations",
+  "num_decoded_blocks",
+  "num_decoded_instructions",
+  "num_index_lookups",
+  "num_index_hits",
+  "num_index_insertions",
+  "num_direct_edge_entries",
+  "num_direct_edge_translations",
+  "num_chained_blocks",
+  "num_indirect_edge_entries",
+  "num_indirect_edge_translations",
+  "num_spills",
+  "num_fills",
+  "num_stack_slots",
+  "num_stack_partitions",
+  "num_tls_slots",
+  "num_tls_partitions",
+  "num_peephole_removed_instructions"
+};
+
+static_assert(kStatNumCodeCacheAllocations ==
+              (sizeof kStatCounterNames / sizeof kStatCounterNames[0]),
+              "Missing name for some statistic counter.");
+
+// Indexed by `CodeCacheKind`.
+static const char * const kCodeCacheKindNames[] = {
+  "hot",
+  "cold",
+  "frozen",
+  "subzero",
+  "edge"
+};
+
+static_assert(kNumCodeCacheKinds ==
+              (sizeof kCodeCacheKindNames / sizeof kCodeCacheKindNames[0]),
+              "Missing name for some code cache kind.");
+
+static const char * const kStatTimerNames[] = {
+  "decode",
+  "instrument",
+  "compile_inline_assembly",
+  "optimize_instrumentation",
+  "mangle_instructions",
+  "build_fragment_list",
+  "partition_fragments",
+  "add_entry_and_exit_fragments",
+  "save_and_restore_flags",
+  "track_virtual_regs",
+  "propagate_register_copies",
+  "schedule_registers",
+  "allocate_slots",
+  "add_connecting_jumps",
+  "find_block_entrypoint_fragments",
+  "peephole_optimize",
+  "stage_encode",
+  "encode",
+  "index_lookup",
+  "allocate_code",
+  "direct_edge_entry",
+  "indirect_edge_entry"
+};
+
+static_assert(kNumStatTimers ==
+              (sizeof kStatTimerNames / sizeof kStatTimerNames[0]),
+              "Missing name for some statistic timer.");
+
+// Returns the current thread's (or CPU's) stripe of statistics.
+static StatStripe &CurrentStripe(void) {
+  const auto base = os::ThreadBase();
+  return gStats[((base >> 12) ^ (base >> 6)) % kNumStatStripes];
+}
+
+// Sums a statistic over all stripes.
+template <typename GetStat>
+static uint64_t SumStat(GetStat get_stat) {
+  auto sum = 0UL;
+  for (auto &stripe : gStats) {
+    sum += get_stat(stripe).load(std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+}  // namespace
+namespace detail {
+
+void AddStat(size_t counter, uint64_t amount) {
+  CurrentStripe().counters[counter].fetch_add(amount,
+                                              std::memory_order_relaxed);
+}
+
+void AddStatTime(StatTimerKind timer, uint64_t num_cycles) {
+  auto &stripe(CurrentStripe());
+  stripe.timer_cycles[timer].fetch_add(num_cycles, std::memory_order_relaxed);
+  stripe.timer_counts[timer].fetch_add(1, std::memory_order_relaxed);
+}
+
+}  // namespace detail
+
+// Log all statistics, as JSON.
+void LogStats(void) {
+  if (!FLAG_collect_stats) return;
+  os::Log(os::LogDebug, "{\"counters\": {");
+  for (auto i = 0UL; i < kStatNumCodeCacheAllocations; ++i) {
+    os::Log(os::LogDebug, "%s\"%s\": %lu", i ? ", " : "", kStatCounterNames[i],
+            SumStat([=] (StatStripe &s) -> std::atomic<uint64_t> & {
+              return s.counters[i];
+            }));
+  }
+  for (auto kind = 0UL; kind < kNumCodeCacheKinds; ++kind) {
+    os::Log(os::LogDebug, ", \"num_code_cache_allocations.%s\": %lu, "
+                          "\"num_code_cache_bytes.%s\": %lu",
+            kCodeCacheKindNames[kind],
+            SumStat([=] (StatStripe &s) -> std::atomic<uint64_t> & {
+              return s.counters[kStatNumCodeCacheAllocations + kind];
+            }),
+            kCodeCacheKindNames[kind],
+            SumStat([=] (StatStripe &s) -> std::atomic<uint64_t> & {
+              return s.counters[kStatNumCodeCacheBytes + kind];
+            }));
+  }
+  os::Log(os::LogDebug, "}, \"timers\": {");
+  for (auto i = 0UL; i < kNumStatTimers; ++i) {
+    os::Log(os::LogDebug, "%s\"%s\": {\"cycles\": %lu, \"count\": %lu}",
+            i ? ", " : "", kStatTimerNames[i],
+            SumStat([=] (StatStripe &s) -> std::atomic<uint64_t> & {
+              return s.timer_cycles[i];
+            }),
+            SumStat([=] (StatStripe &s) -> std::atomic<uint64_t> & {
+              return s.timer_counts[i];
+            }));
+  }
+  os::Log(os::LogDebug, "}}\n");
+}
+
+}  // namespace granary
@@ -0,0 +1,124 @@
+/* Copyright 2015 Peter Goodman, all rights reserved. */
+
+#ifndef GRANARY_STATS_H_
+#define GRANARY_STATS_H_
+
+#ifndef GRANARY_INTERNAL
+# error "This code is internal to Granary."
+#endif
+
+#include "arch/cpu.h"
+
+#include "granary/base/base.h"
+#include "granary/base/option.h"
+
+#include "granary/cache.h"
+
+GRANARY_DECLARE_bool(collect_stats);
+
+namespace granary {
+
+// Things that Granary counts about its own execution.
+enum StatCounter : size_t {
+  kStatNumTranslations,
+  kStatNumDecodedBlocks,
+  kStatNumDecodedInstructions,
+  kStatNumIndexLookups,
+  kStatNumIndexHits,
+  kStatNumIndexInsertions,
+  kStatNumDirectEdgeEntries,
+  kStatNumDirectEdgeTranslations,
+  kStatNumChainedBlocks,
+  kStatNumIndirectEdgeEntries,
+  kStatNumIndirectEdgeTranslations,
+  kStatNumSpills,
+  kStatNumFills,
+  kStatNumStackSlots,
+  kStatNumStackPartitions,
+  kStatNumTLSSlots,
+  kStatNumTLSPartitions,
+  kStatNumPeepholeRemovedInstructions,
+
+  // One counter per `CodeCacheKind`.
+  kStatNumCodeCacheAllocations,
+  kStatNumCodeCacheBytes = kStatNumCodeCacheAllocations + kNumCodeCacheKinds,
+
+  kNumStatCounters = kStatNumCodeCacheBytes + kNumCodeCacheKinds
+};
+
+// Phases of translation that Granary times.
+enum StatTimerKind : size_t {
+  kStatTimeDecode,
+  kStatTimeInstrument,
+  kStatTimeCompileInlineAssembly,
+  kStatTimeOptimizeInstrumentation,
+  kStatTimeMangleInstructions,
+  kStatTimeBuildFragmentList,
+  kStatTimePartitionFragments,
+  kStatTimeAddEntryAndExitFragments,
+  kStatTimeSaveAndRestoreFlags,
+  kStatTimeTrackVirtualRegs,
+  kStatTimePropagateRegisterCopies,
+  kStatTimeScheduleRegisters,
+  kStatTimeAllocateSlots,
+  kStatTimeAddConnectingJumps,
+  kStatTimeFindBlockEntrypointFragments,
+  kStatTimePeepholeOptimize,
+  kStatTimeStageEncode,
+  kStatTimeEncode,
+  kStatTimeIndexLookup,
+  kStatTimeAllocateCode,
+  kStatTimeDirectEdgeEntry,
+  kStatTimeIndirectEdgeEntry,
+
+  kNumStatTimers
+};
+
+namespace detail {
+void AddStat(size_t counter, uint64_t amount);
+void AddStatTime(StatTimerKind timer, uint64_t num_cycles);
+}  // namespace detail
+
+// Adds `amount` to some statistic counter.
+inline static void AddStat(StatCounter counter, uint64_t amount=1) {
+  if (GRANARY_UNLIKELY(FLAG_collect_stats)) detail::AddStat(counter, amount);
+}
+
+// Adds `amount` to the `kind`-specific counter of some per-`CodeCacheKind`
+// statistic.
+inline static void AddStat(StatCounter counter, CodeCacheKind kind,
+                           uint64_t amount) {
+  if (GRANARY_UNLIKELY(FLAG_collect_stats)) {
+    detail::AddStat(counter + static_cast<size_t>(kind), amount);
+  }
+}
+
+// Times some region of code, e.g. a phase of translation, by the number of
+// cycles elapsed between construction and destruction of the timer.
+class StatTimer {
+ public:
+  inline explicit StatTimer(StatTimerKind kind_)
+      : kind(kind_),
+        start(GRANARY_UNLIKELY(FLAG_collect_stats) ? arch::CycleCount() : 0) {}
+
+  inline ~StatTimer(void) {
+    if (GRANARY_UNLIKELY(start)) {
+      detail::AddStatTime(kind, arch::CycleCount() - start);
+    }
+  }
+
+ private:
+  StatTimer(void) = delete;
+
+  const StatTimerKind kind;
+  const uint64_t start;
+
+  GRANARY_DISALLOW_COPY_AND_ASSIGN(StatTimer);
+};
+
+// Log all statistics, as JSON.
+void LogStats(void);
+
+}  // namespace granary
+
+#endif  // GRANARY_STATS_H_
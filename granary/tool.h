@@ -49,7 +49,10 @@ class InstrumentationTool {
   // should be materialized.
   //
   // This method is repeatedly executed until no more materialization
-  // requests are made, or until a pre-defined limit is reached.
+  // requests are made, or until a pre-defined limit is reached. Each execution
+  // should only look at the blocks materialized since the previous execution,
+  // i.e. `trace->NewBlocks()`, and the control-flow instructions targeting
+  // them; iterations that materialize nothing new are skipped.
   virtual void InstrumentControlFlow(BlockFactory *factory, Trace *trace);
 
   // Used to implement more complex forms of instrumentation where tools need
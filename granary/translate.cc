@@ -2,6 +2,8 @@
 
 #define GRANARY_INTERNAL
 
+#include "granary/base/option.h"
+
 #include "granary/cfg/block.h"
 #include "granary/cfg/trace.h"
 
@@ -16,6 +18,18 @@
 #include "granary/instrument.h"
 #include "granary/translate.h"
 
+GRANARY_DEFINE_bool(profile_direct_edges, false,
+    "Should Granary count the number of times that the code of each direct "
+    "edge is executed? If enabled, then a trace that is first reached by a "
+    "rarely taken exit of a hot trace is placed into the cold code cache, "
+    "which keeps the hot code cache dense. The default is `no`.");
+
+GRANARY_DEFINE_positive_uint(cold_edge_threshold, 64,
+    "The number of times that the other exits of a trace must have been "
+    "executed before one of its direct edges is first taken in order for the "
+    "target of that edge to be considered cold. This is only used if "
+    "`--profile_direct_edges` is enabled. The default value is `64`.");
+
 namespace granary {
 namespace {
 
@@ -48,10 +62,11 @@ static void Index(Trace *cfg) {
 
 // Compile and index blocks. This is used for direct edges and entrypoints.
 static CachePC CompileAndIndex(Context *context, Trace *trace,
-                               BlockMetaData *meta) {
+                               BlockMetaData *meta,
+                               CachePC chain_pc=nullptr) {
   auto cache_meta = MetaDataCast<CacheMetaData *>(meta);
   if (!cache_meta->start_pc) {  // Only compile if we decoded the first block.
-    auto encoded_pc = Compile(context, trace);
+    auto encoded_pc = Compile(context, trace, chain_pc);
     Index(trace);
     GRANARY_ASSERT(nullptr != cache_meta->start_pc);
     return encoded_pc;
@@ -60,6 +75,28 @@ static CachePC CompileAndIndex(Context *context, Trace *trace,
   }
 }
 
+// Returns true if `edge` is a rarely taken exit of its trace. That is, the
+// other exits of the trace have been executed many times before `edge` is
+// taken for the first time.
+static bool IsUnlikelyEdge(const DirectEdge *edge) {
+  if (!FLAG_profile_direct_edges) return false;
+  auto num_sibling_executions = 0UL;
+  for (auto sibling = edge->next_sibling; sibling != edge;
+       sibling = sibling->next_sibling) {
+    num_sibling_executions += sibling->num_executions;
+  }
+  return num_sibling_executions >= FLAG_cold_edge_threshold;
+}
+
+// Move all decoded blocks of a trace into the cold code cache.
+static void MarkAsColdCode(Trace *cfg) {
+  for (auto block : cfg->Blocks()) {
+    if (auto dblock = DynamicCast<DecodedBlock *>(block)) {
+      dblock->MarkAsColdCode();
+    }
+  }
+}
+
 }  // namespace
 
 // Instrument, compile, and index some basic blocks.
@@ -75,6 +112,19 @@ CachePC Translate(Context *context, BlockMetaData *meta) {
   return CompileAndIndex(context, &cfg, meta);
 }
 
+// Instrument, compile, and index some basic blocks, where the entry block
+// is targeted by a direct edge. If profiling says that the edge is unlikely to
+// be taken then the blocks are placed into the cold code cache. If `chain_pc`
+// is non-null, then the blocks are placed at `chain_pc` if possible.
+CachePC Translate(Context *context, DirectEdge *edge, CachePC chain_pc) {
+  auto meta = edge->dest_block_meta;
+  Trace cfg(context);
+  BinaryInstrumenter inst(&cfg, &meta);
+  inst.InstrumentDirect();
+  if (IsUnlikelyEdge(edge)) MarkAsColdCode(&cfg);
+  return CompileAndIndex(context, &cfg, meta, chain_pc);
+}
+
 // Instrument, compile, and index some basic blocks, where the entry block
 // is targeted by an indirect control-transfer instruction.
 //
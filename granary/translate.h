@@ -17,6 +17,7 @@ namespace granary {
 // Forward declarations.
 class Context;
 class BlockMetaData;
+class DirectEdge;
 class IndirectEdge;
 
 // Instrument, compile, and index some basic blocks.
@@ -25,6 +26,12 @@ CachePC Translate(Context *context, AppPC pc);
 // Instrument, compile, and index some basic blocks.
 CachePC Translate(Context *context, BlockMetaData *meta);
 
+// Instrument, compile, and index some basic blocks, where the entry block
+// is targeted by a direct edge. If `chain_pc` is non-null, then the blocks
+// are placed at `chain_pc` if possible.
+CachePC Translate(Context *context, DirectEdge *edge,
+                  CachePC chain_pc=nullptr);
+
 // Instrument, compile, and index some basic blocks, where the entry block
 // is targeted by an indirect control-transfer instruction.
 CachePC Translate(Context *context, IndirectEdge *edge, BlockMetaData *meta);
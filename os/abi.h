@@ -10,6 +10,8 @@
 
 #include "arch/context.h"
 
+#include "granary/code/register.h"
+
 namespace granary {
 namespace os {
 namespace abi {
@@ -26,6 +28,10 @@ uint64_t *FunctionCallReturnValue(arch::MachineContext *context);
 // machine context.
 uint64_t *SystemCallNumber(arch::MachineContext *context);
 
+// Returns the register that holds the system call number just before a
+// system call instruction executes.
+VirtualRegister SystemCallNumberRegister(void);
+
 // Returns a pointer to the Nth system call argument, given a machine context.
 //
 // Note: `n == 0` is the first argument.
@@ -12,6 +12,7 @@
 #include "os/abi.h"
 
 #include "arch/x86-64/context.h"
+#include "arch/x86-64/register.h"
 
 namespace granary {
 namespace os {
@@ -43,6 +44,12 @@ uint64_t *SystemCallNumber(arch::MachineContext *context) {
   return &(context->rax);
 }
 
+// Returns the register that holds the system call number just before a
+// system call instruction executes.
+VirtualRegister SystemCallNumberRegister(void) {
+  return arch::REG_RAX;
+}
+
 // Returns a pointer to the Nth system call argument, given a machine context.
 //
 // Note: `n == 0` is the first argument.
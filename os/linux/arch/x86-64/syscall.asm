@@ -122,6 +122,18 @@ DEFINE_FUNC(getpid)
     ret
 END_FUNC(getpid)
 
+DEFINE_FUNC(sys_gettid)
+    mov    eax, 186  // `__NR_gettid`.
+    syscall
+    ret
+END_FUNC(sys_gettid)
+
+DEFINE_FUNC(sys_write)
+    mov    eax, 1  // `__NR_write`.
+    syscall
+    ret
+END_FUNC(sys_write)
+
 DEFINE_FUNC(alarm)
     mov    eax, 37  // `__NR_alarm`.
     syscall
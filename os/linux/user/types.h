@@ -179,6 +179,12 @@ extern long sys_clone(unsigned long clone_flags, char *newsp,
 
 extern int arch_prctl(int option, ...);
 
+// Raw gettid system call.
+extern long sys_gettid(void);
+
+// Raw write system call. Returns `-errno` on failure.
+extern long sys_write(int fd, const void *buf, size_t count);
+
 #undef __restrict
 
 #endif  // OS_LINUX_USER_TYPES_H_
@@ -158,6 +158,15 @@ bool Module::Contains(AppPC pc) const {
   return nullptr != FindRange(ranges, pc);
 }
 
+// Returns true if a module contains the data address `addr`, and if that
+// address is mapped as readable but not writable (e.g. `.rodata`).
+bool Module::ContainsReadOnly(const void *addr) const {
+  ReadLockedRegion locker(&ranges_lock);
+  auto range = FindRange(ranges, reinterpret_cast<uintptr_t>(addr));
+  return range && MODULE_READABLE == (range->perms & (MODULE_READABLE |
+                                                      MODULE_WRITABLE));
+}
+
 // Returns the path of this module.
 const char *Module::Path(void) const {
   return &(path[0]);
@@ -91,6 +91,10 @@ class Module {
   // address is marked as executable.
   bool Contains(AppPC pc) const;
 
+  // Returns true if a module contains the data address `addr`, and if that
+  // address is mapped as readable but not writable (e.g. `.rodata`).
+  bool ContainsReadOnly(const void *addr) const;
+
   // Returns the path of this module.
   const char *Path(void) const;
 
@@ -0,0 +1,115 @@
+/* Copyright 2015 Peter Goodman, all rights reserved. */
+
+#include <gmock/gmock.h>
+
+#include <vector>
+
+#define GRANARY_INTERNAL
+#define GRANARY_TEST
+
+#include "granary/base/option.h"
+
+#include "granary/cfg/block.h"
+#include "granary/cfg/instruction.h"
+#include "granary/cfg/operand.h"
+
+#include "granary/context.h"
+#include "granary/tool.h"
+#include "granary/translate.h"
+
+#include "test/util/simple_encoder.h"
+
+using namespace granary;
+using namespace testing;
+
+GRANARY_DECLARE_string(tools);
+
+extern "C" {
+extern void TestMemOp_FramePointerDisp(void);
+extern void TestMemOp_GPRDisp(void);
+extern void TestMemOp_GroupedGPRDisps(void);
+}
+
+namespace {
+
+// What the tool saw of the address register of one memory operand.
+struct MemOpAddress {
+  bool is_stack_pointer_alias;
+  bool is_frame_pointer_alias;
+
+  // The base register and displacement of the original memory operand.
+  bool has_base_and_disp;
+  VirtualRegister base;
+  intptr_t disp;
+};
+
+static std::vector<MemOpAddress> gMemOpAddresses;
+
+}  // namespace
+
+// Records how the memory operands of application instructions are addressed
+// after early mangling.
+class MemOpRecorder : public InstrumentationTool {
+ public:
+  virtual ~MemOpRecorder(void) = default;
+  virtual void InstrumentBlock(DecodedBlock *block) {
+    for (auto instr : block->AppInstructions()) {
+      MemoryOperand mloc;
+      VirtualRegister addr_reg;
+      if (!instr->MatchOperands(ReadOrWriteTo(mloc))) continue;
+      if (mloc.IsEffectiveAddress() || !mloc.MatchRegister(addr_reg)) continue;
+      MemOpAddress addr = {addr_reg.IsStackPointerAlias(),
+                           addr_reg.IsFramePointerAlias(), false,
+                           VirtualRegister(), 0};
+      addr.has_base_and_disp = instr->MatchBaseAndDisplacement(
+          mloc, addr.base, addr.disp);
+      gMemOpAddresses.push_back(addr);
+    }
+  }
+};
+
+class MemOpTest : public SimpleEncoderTest {
+ public:
+  virtual ~MemOpTest(void) = default;
+
+  static void SetUpTestCase(void) {
+    AddInstrumentationTool<MemOpRecorder>("mem_op_recorder");
+    FLAG_tools = "mem_op_recorder";
+    SimpleEncoderTest::SetUpTestCase();
+  }
+
+  virtual void SetUp(void) {
+    gMemOpAddresses.clear();
+  }
+};
+
+TEST_F(MemOpTest, FramePointerDisplacementIsFramePointerAlias) {
+  TranslateEntryPoint(context, TestMemOp_FramePointerDisp,
+                      kEntryPointTestCase);
+  ASSERT_FALSE(gMemOpAddresses.empty());
+  EXPECT_TRUE(gMemOpAddresses[0].is_frame_pointer_alias);
+  EXPECT_FALSE(gMemOpAddresses[0].is_stack_pointer_alias);
+}
+
+TEST_F(MemOpTest, GPRDisplacementIsNotFramePointerAlias) {
+  TranslateEntryPoint(context, TestMemOp_GPRDisp, kEntryPointTestCase);
+  ASSERT_FALSE(gMemOpAddresses.empty());
+  EXPECT_FALSE(gMemOpAddresses[0].is_frame_pointer_alias);
+  EXPECT_FALSE(gMemOpAddresses[0].is_stack_pointer_alias);
+}
+
+TEST_F(MemOpTest, DisplacedAccessesShareTheirBase) {
+  TranslateEntryPoint(context, TestMemOp_GroupedGPRDisps, kEntryPointTestCase);
+  ASSERT_LE(2UL, gMemOpAddresses.size());
+  const auto &first(gMemOpAddresses[0]);
+  const auto &second(gMemOpAddresses[1]);
+  ASSERT_TRUE(first.has_base_and_disp);
+  ASSERT_TRUE(second.has_base_and_disp);
+
+  // Both accesses are grouped on the native `RDI`, not on the virtual
+  // registers introduced by early mangling.
+  EXPECT_TRUE(first.base.IsNative());
+  EXPECT_TRUE(first.base == second.base);
+  EXPECT_EQ(8, first.disp);
+  EXPECT_EQ(16, second.disp);
+}
@@ -0,0 +1,70 @@
+/* Copyright 2015 Peter Goodman, all rights reserved. */
+
+#define GRANARY_INTERNAL
+#define GRANARY_ARCH_INTERNAL
+#define GRANARY_TEST
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <vector>
+
+#include "arch/driver.h"
+#include "arch/x86-64/select.h"
+
+#include "granary/base/cast.h"
+
+#include "granary/exit.h"
+#include "granary/init.h"
+
+extern "C" {
+  extern void TestDecode_Instructions(void);
+  extern void TestDecode_Instructions_End(void);
+}
+
+namespace granary {
+namespace arch {
+extern void InitSelectionCache(void);
+}  // namespace arch
+}  // namespace granary
+
+TEST(SelectTest, CachedSelectionMatchesUncachedSelection) {
+  using namespace granary;
+  Init(kInitAttach);
+
+  const auto first = UnsafeCast<AppPC>(TestDecode_Instructions);
+  const auto end = UnsafeCast<AppPC>(TestDecode_Instructions_End);
+  std::vector<const xed_inst_t *> uncached_selections;
+  arch::Instruction instr;
+
+  // Select each instruction with an empty cache, then select it again, which
+  // should hit in the cache.
+  for (auto begin = first; begin < end; ) {
+    if (!arch::InstructionDecoder::DecodeNext(&instr, &begin)) break;
+    arch::InitSelectionCache();
+    auto uncached_xedi = arch::SelectInstruction(&instr);
+    auto uncached_iform = instr.iform;
+    auto uncached_isel = instr.isel;
+    uncached_selections.push_back(uncached_xedi);
+
+    auto cached_xedi = arch::SelectInstruction(&instr);
+    EXPECT_EQ(uncached_xedi, cached_xedi);
+    EXPECT_EQ(uncached_iform, instr.iform);
+    EXPECT_EQ(uncached_isel, instr.isel);
+  }
+  EXPECT_FALSE(uncached_selections.empty());
+
+  // Select every instruction again, without clearing the cache between
+  // instructions, so that selections cached for one instruction might be
+  // reused by later instructions of the same iclass.
+  auto i = 0UL;
+  for (auto begin = first; begin < end; ++i) {
+    if (!arch::InstructionDecoder::DecodeNext(&instr, &begin)) break;
+    ASSERT_LT(i, uncached_selections.size());
+    EXPECT_EQ(uncached_selections[i], arch::SelectInstruction(&instr));
+    EXPECT_EQ(xed_inst_iform_enum(uncached_selections[i]), instr.iform);
+  }
+  EXPECT_EQ(uncached_selections.size(), i);
+
+  Exit(kExitDetach);
+}
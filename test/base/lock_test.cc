@@ -0,0 +1,115 @@
+/* Copyright 2015 Peter Goodman, all rights reserved. */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#define GRANARY_INTERNAL
+#define GRANARY_TEST
+
+#include "granary/base/base.h"
+#include "granary/base/lock.h"
+
+using namespace granary;
+
+namespace {
+
+// How long to give another thread to (incorrectly) acquire a lock.
+static void WaitForOtherThread(void) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+}
+
+}  // namespace
+
+TEST(DistributedReaderWriterLockTest, WriterExcludesReaders) {
+  DistributedReaderWriterLock lock;
+  std::atomic<bool> did_read(false);
+
+  lock.WriteAcquire();
+  std::thread reader([&] {
+    DistributedReadLockedRegion locker(&lock);
+    did_read.store(true);
+  });
+  WaitForOtherThread();
+  EXPECT_FALSE(did_read.load());
+
+  lock.WriteRelease();
+  reader.join();
+  EXPECT_TRUE(did_read.load());
+}
+
+TEST(DistributedReaderWriterLockTest, ReadersExcludeWriter) {
+  DistributedReaderWriterLock lock;
+  std::atomic<bool> did_write(false);
+
+  auto token = lock.ReadAcquire();
+  std::thread writer([&] {
+    lock.WriteAcquire();
+    did_write.store(true);
+    lock.WriteRelease();
+  });
+  WaitForOtherThread();
+  EXPECT_FALSE(did_write.load());
+
+  lock.ReadRelease(token);
+  writer.join();
+  EXPECT_TRUE(did_write.load());
+}
+
+TEST(DistributedReaderWriterLockTest, ReadersShareTheLock) {
+  DistributedReaderWriterLock lock;
+  std::atomic<bool> did_read(false);
+
+  auto token = lock.ReadAcquire();
+  std::thread reader([&] {
+    DistributedReadLockedRegion locker(&lock);
+    did_read.store(true);
+  });
+  reader.join();
+  EXPECT_TRUE(did_read.load());
+  lock.ReadRelease(token);
+}
+
+TEST(DistributedReaderWriterLockTest, ReadersNeverSeePartialWrites) {
+  enum {
+    kNumReaders = 4,
+    kNumWriters = 2,
+    kNumIterations = 2000
+  };
+  DistributedReaderWriterLock lock;
+  std::atomic<int> num_writers_inside(0);
+  std::atomic<bool> saw_bad_state(false);
+  int values[2] = {0, 0};
+
+  std::vector<std::thread> threads;
+  for (auto i = 0; i < kNumWriters; ++i) {
+    threads.emplace_back([&] {
+      for (auto j = 0; j < kNumIterations; ++j) {
+        lock.WriteAcquire();
+        if (num_writers_inside.fetch_add(1)) saw_bad_state.store(true);
+        ++values[0];
+        ++values[1];
+        num_writers_inside.fetch_sub(1);
+        lock.WriteRelease();
+      }
+    });
+  }
+  for (auto i = 0; i < kNumReaders; ++i) {
+    threads.emplace_back([&] {
+      for (auto j = 0; j < kNumIterations; ++j) {
+        DistributedReadLockedRegion locker(&lock);
+        if (num_writers_inside.load() || values[0] != values[1]) {
+          saw_bad_state.store(true);
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) thread.join();
+
+  EXPECT_FALSE(saw_bad_state.load());
+  EXPECT_EQ(kNumWriters * kNumIterations, values[0]);
+  EXPECT_EQ(kNumWriters * kNumIterations, values[1]);
+}